@@ -0,0 +1,358 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Throughput and latency benchmark for the message-groups sender and
+// receiver and the multithreading send_handler, against a broker such as the
+// Proton example broker on localhost:
+//
+//   broker &
+//   menagerie-bench --count 1000000 --size 1024 --producers 4 --consumers 4
+//
+// Every message is stamped with its send time, so latency is measured from
+// the producer handing a message to the API until a consumer has it. The
+// encoded API sends messages encoded before the run, so there is no latency
+// to measure.
+//
+// --presettled 1 opens sender links AT_MOST_ONCE, pre-settled, for comparing
+// fire-and-forget against the default at-least-once delivery:
+//
+//   menagerie-bench --count 1000000 --size 64
+//   menagerie-bench --count 1000000 --size 64 --presettled 1
+//
+// --api envelope packs up to --batch messages of a group into each AMQP
+// message with a batching_sender, which receivers unpack:
+//
+//   menagerie-bench --count 1000000 --size 200 --api envelope --batch 100
+//
+// --compress BYTES deflates message bodies of at least that size, or whole
+// envelopes, before they are sent, and receivers inflate them:
+//
+//   menagerie-bench --count 1000000 --size 4096 --compress 1024
+
+#include "batching_sender.hpp"
+#include "encoded_message.hpp"
+#include "histogram.hpp"
+#include "receiver.hpp"
+#include "send_handler.hpp"
+#include "sender.hpp"
+
+#include <proton/container.hpp>
+#include <proton/delivery_mode.hpp>
+#include <proton/message.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+    typedef std::chrono::steady_clock bench_clock;
+    
+    const char* SENT_AT = "menagerie-bench-sent-ns";
+    const int IDLE_SECONDS = 10;       // Give up when nothing arrives for this long
+    
+    struct options
+    {
+        std::string url = "amqp://127.0.0.1";
+        std::string address = "menagerie-bench";
+        std::string api = "sender";    // sender, batch, envelope, encoded or send_handler
+        std::string corpus;            // Corpus file for the encoded API
+        size_t size = 256;
+        int count = 100000;
+        int producers = 1;
+        int consumers = 1;
+        int groups = 0;                // Distinct group ids, 0 for no groups
+        size_t credit = 0;             // Fixed receiver credit window, 0 for adaptive
+        size_t receiver_bytes = 0;     // Byte budget of each receiver, 0 for the default
+        size_t memory_ceiling = 0;     // Bytes buffered by all receivers, 0 for no ceiling
+        int batch = 100;
+        int linger = 5;                // Milliseconds an envelope may wait to fill
+        int io_threads = 1;
+        bool presettled = false;       // Send AT_MOST_ONCE
+        size_t compress = 0;           // Compression threshold, 0 for no compression
+    };
+    
+    void usage(const char* prog)
+    {
+        std::cerr <<
+        "Usage: " << prog << " [OPTIONS]\n"
+        "--url URL             connection address, default amqp://127.0.0.1\n"
+        "--address ADDRESS     AMQP node address, default menagerie-bench\n"
+        "--api API             sender, batch (sender::send_batch), envelope (batching_sender),\n"
+        "                      encoded (pre-encoded messages) or send_handler, default sender\n"
+        "--corpus FILE         messages for the encoded API to replay, as written from a\n"
+        "                      journal by journal-to-corpus, default one per group\n"
+        "--size BYTES          message body size, default 256\n"
+        "--count N             messages in total, default 100000\n"
+        "--producers N         producer threads, each with its own connection, default 1\n"
+        "--consumers N         consumer threads, each with its own receiver, default 1\n"
+        "--groups N            spread messages over N group ids, default 0 for no groups\n"
+        "--credit N            fixed receiver credit window, default 0 for adaptive\n"
+        "--receiver-bytes N    byte budget of each receiver, default 16MB\n"
+        "--memory-ceiling N    bytes buffered by all receivers together, default 0 for none\n"
+        "--batch N             messages per send_batch() call or envelope, default 100\n"
+        "--linger MS           longest an envelope waits to fill, default 5\n"
+        "--io-threads N        threads running the container, default 1\n"
+        "--presettled 0|1      send pre-settled, at most once, default 0\n"
+        "--compress BYTES      deflate bodies of at least BYTES, default 0 for never\n";
+    }
+    
+    bool parse(int argc, const char** argv, options& o)
+    {
+        for (int i = 1; i < argc; i += 2)
+        {
+            if (i + 1 >= argc)
+                return false;
+            std::string name = argv[i];
+            const char* value = argv[i + 1];
+            if (name == "--url") o.url = value;
+            else if (name == "--address") o.address = value;
+            else if (name == "--api") o.api = value;
+            else if (name == "--corpus") o.corpus = value;
+            else if (name == "--size") o.size = size_t(atol(value));
+            else if (name == "--count") o.count = atoi(value);
+            else if (name == "--producers") o.producers = std::max(1, atoi(value));
+            else if (name == "--consumers") o.consumers = std::max(1, atoi(value));
+            else if (name == "--groups") o.groups = std::max(0, atoi(value));
+            else if (name == "--credit") o.credit = size_t(atol(value));
+            else if (name == "--receiver-bytes") o.receiver_bytes = size_t(atol(value));
+            else if (name == "--memory-ceiling") o.memory_ceiling = size_t(atol(value));
+            else if (name == "--batch") o.batch = std::max(1, atoi(value));
+            else if (name == "--linger") o.linger = std::max(0, atoi(value));
+            else if (name == "--io-threads") o.io_threads = std::max(1, atoi(value));
+            else if (name == "--presettled") o.presettled = atoi(value) != 0;
+            else if (name == "--compress") o.compress = size_t(atol(value));
+            else return false;
+        }
+        return o.api == "sender" || o.api == "batch" || o.api == "envelope" || o.api == "encoded" ||
+               o.api == "send_handler";
+    }
+    
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count();
+    }
+    
+    proton::message make_message(const options& o, const std::string& body, int k)
+    {
+        proton::message m(body);
+        if (o.groups > 0)
+            m.group_id("group-" + std::to_string(k % o.groups));
+        m.properties().put(SENT_AT, now_ns());
+        return m;
+    }
+    
+    // The messages the encoded API sends in turn
+    std::vector<encoded_message> make_corpus(const options& o)
+    {
+        if (!o.corpus.empty())
+            return load_corpus(o.corpus);
+        
+        std::vector<encoded_message> corpus;
+        const std::string body(o.size, 'x');
+        for (int k = 0; k < std::max(1, o.groups); ++k)
+        {
+            proton::message m(body);
+            if (o.groups > 0)
+                m.group_id("group-" + std::to_string(k));
+            corpus.push_back(encoded_message(m));
+        }
+        return corpus;
+    }
+    
+    proton::delivery_mode delivery(const options& o)
+    {
+        return o.presettled ? proton::delivery_mode::AT_MOST_ONCE : proton::delivery_mode::AT_LEAST_ONCE;
+    }
+    
+    // Send n messages through the chosen API
+    void produce(const options& o, proton::container& container, int n, const std::vector<encoded_message>& corpus)
+    {
+        const std::string body(o.size, 'x');
+        if (o.api == "send_handler")
+        {
+            send_handler handler(o.url, o.address, false, send_limits(), delivery(o));
+            proton::container handler_container(handler);
+            std::thread t([&]() { handler_container.run(); });
+            for (int k = 0; k < n; ++k)
+                handler.send(make_message(o, body, k));
+            handler.close();
+            t.join();
+            return;
+        }
+        
+        compression_policy compression;
+        if (o.compress)
+            compression = compression_policy::deflate(o.compress);
+        sender s(container, o.url, o.address, delivery(o), 0, compression);
+        if (o.api == "batch")
+        {
+            for (int k = 0; k < n; )
+            {
+                std::vector<proton::message> messages;
+                for (int end = std::min(n, k + o.batch); k < end; ++k)
+                    messages.push_back(make_message(o, body, k));
+                s.send_batch(std::move(messages));
+            }
+        }
+        else if (o.api == "envelope")
+        {
+            batch_policy policy;
+            policy.max_messages = size_t(o.batch);
+            policy.max_bytes = size_t(o.batch) * (o.size + 64);
+            policy.linger = std::chrono::milliseconds(o.linger);
+            batching_sender b(s, policy);
+            for (int k = 0; k < n; ++k)
+                b.send(make_message(o, body, k));
+        }
+        else if (o.api == "encoded")
+        {
+            for (int k = 0; k < n; ++k)
+                s.send(corpus[size_t(k) % corpus.size()]);
+        }
+        else
+        {
+            for (int k = 0; k < n; ++k)
+                s.send(make_message(o, body, k));
+        }
+        s.close();
+    }
+    
+    // Receive until total messages have arrived over all consumers, or
+    // nothing has arrived for a while
+    void consume(receiver& r, int total, std::atomic<int>& received, histogram& latency, bench_clock::time_point& last)
+    {
+        std::vector<proton::message> messages;
+        int idle = 0;
+        while (received < total && idle < IDLE_SECONDS)
+        {
+            messages.clear();
+            size_t n = r.receive_batch(messages, 256, 1);
+            if (n == 0)
+            {
+                ++idle;
+                continue;
+            }
+            idle = 0;
+            int64_t now = now_ns();
+            for (auto& m : messages)
+            {
+                if (m.properties().exists(SENT_AT))
+                    latency.record(uint64_t(now - proton::get<int64_t>(m.properties().get(SENT_AT))));
+            }
+            received += int(n);
+            last = bench_clock::now();
+        }
+    }
+}
+
+int main(int argc, const char **argv) {
+    options o;
+    if (!parse(argc, argv, o)) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    try {
+        std::vector<encoded_message> corpus;
+        if (o.api == "encoded")
+        {
+            corpus = make_corpus(o);
+            if (corpus.empty())
+                throw std::runtime_error("empty corpus " + o.corpus);
+        }
+        
+        proton::container container;
+        auto container_thread = std::thread([&]() { container.run(o.io_threads); });
+        
+        credit_limits limits;
+        if (o.credit > 0)
+        {
+            limits.min_messages = o.credit;
+            limits.max_messages = o.credit;
+        }
+        if (o.receiver_bytes > 0)
+            limits.max_bytes = o.receiver_bytes;
+        memory_budget::process().ceiling(o.memory_ceiling);
+        std::vector<std::unique_ptr<receiver> > receivers;
+        for (int i = 0; i < o.consumers; ++i)
+            receivers.push_back(std::unique_ptr<receiver>(new receiver(container, o.url, o.address, limits)));
+        
+        const int per_producer = o.count / o.producers;
+        const int total = per_producer * o.producers;
+        std::atomic<int> received(0);
+        std::vector<std::unique_ptr<histogram> > latencies;
+        std::vector<bench_clock::time_point> last(o.consumers);
+        std::vector<std::thread> threads;
+        
+        auto start = bench_clock::now();
+        for (int i = 0; i < o.consumers; ++i)
+        {
+            latencies.push_back(std::unique_ptr<histogram>(new histogram()));
+            receiver& r = *receivers[i];
+            histogram& h = *latencies.back();
+            bench_clock::time_point& l = last[i];
+            threads.push_back(std::thread([&, total]() { consume(r, total, received, h, l); }));
+        }
+        for (int i = 0; i < o.producers; ++i)
+            threads.push_back(std::thread([&, per_producer]() { produce(o, container, per_producer, corpus); }));
+        for (auto& t : threads)
+            t.join();
+        
+        auto end = *std::max_element(last.begin(), last.end());
+        double seconds = std::chrono::duration<double>(end - start).count();
+        histogram latency;
+        for (auto& h : latencies)
+            latency.merge(*h);
+        
+        for (auto& r : receivers)
+            r->close();
+        container_thread.join();
+        
+        std::cout << "api " << o.api << ", " << total << " x " << o.size << " bytes, "
+                  << o.producers << " producers, " << o.consumers << " consumers, "
+                  << "groups " << (o.groups ? std::to_string(o.groups) : "off") << ", "
+                  << "credit " << (o.credit ? std::to_string(o.credit) : "adaptive") << ", "
+                  << "io-threads " << o.io_threads << ", "
+                  << (o.presettled ? "at-most-once" : "at-least-once") << "\n";
+        std::cout << "received " << received << "/" << total << " in " << seconds << " s\n";
+        if (seconds > 0)
+            std::cout << "throughput " << int(received / seconds) << " msgs/s "
+                      << received * double(o.size) / seconds / (1024 * 1024) << " MB/s\n";
+        std::cout << "latency ";
+        latency.print(std::cout);
+        std::cout << std::endl;
+        
+        return received == total ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}
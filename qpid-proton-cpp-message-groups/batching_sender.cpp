@@ -0,0 +1,103 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "batching_sender.hpp"
+#include "sender.hpp"
+
+#include <algorithm>
+
+
+batching_sender::batching_sender(sender& s, const batch_policy& policy)
+: sender_(s), policy_(policy), stop_(false)
+{
+    linger_ = std::thread([this]() { run_linger(); });
+}
+
+batching_sender::~batching_sender()
+{
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    linger_.join();
+    flush();
+}
+
+void batching_sender::send(const proton::message& m)
+{
+    const std::string group = m.group_id();
+    std::lock_guard<std::mutex> l(lock_);
+    auto i = groups_.find(group);
+    if (i == groups_.end())
+        i = groups_.insert(std::make_pair(group, pending{ message_batch(group), std::chrono::steady_clock::now() })).first;
+    pending& p = i->second;
+    if (p.batch.empty())
+    {
+        p.first = std::chrono::steady_clock::now();
+        wake_.notify_all();     // There may be a sooner deadline
+    }
+    p.batch.add(m);
+    if (p.batch.bytes() >= policy_.max_bytes || p.batch.size() >= policy_.max_messages)
+        send_batch(p);
+}
+
+void batching_sender::flush()
+{
+    std::lock_guard<std::mutex> l(lock_);
+    for (auto& g : groups_)
+    {
+        if (!g.second.batch.empty())
+            send_batch(g.second);
+    }
+}
+
+// Called with lock_ held
+void batching_sender::send_batch(pending& p)
+{
+    sender_.send(p.batch.take());
+}
+
+// Sends each batch once it has lingered, sleeping until the next is due
+void batching_sender::run_linger()
+{
+    std::unique_lock<std::mutex> l(lock_);
+    while (!stop_)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto next = now + policy_.linger;
+        for (auto i = groups_.begin(); i != groups_.end();)
+        {
+            pending& p = i->second;
+            if (p.batch.empty())
+            {
+                // Groups come and go, forget the idle ones
+                i = groups_.erase(i);
+                continue;
+            }
+            auto due = p.first + policy_.linger;
+            if (due <= now)
+                send_batch(p);
+            else
+                next = std::min(next, due);
+            ++i;
+        }
+        wake_.wait_until(l, next);
+    }
+}
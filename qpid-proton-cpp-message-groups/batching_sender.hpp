@@ -0,0 +1,96 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef batching_sender_hpp
+#define batching_sender_hpp
+
+#include "message_batch.hpp"
+
+#include <proton/message.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+class sender;
+
+
+// When a batching_sender sends a group's batch
+struct batch_policy
+{
+    size_t max_bytes;                   // once its encoded messages are this big
+    size_t max_messages;                // or it holds this many
+    std::chrono::milliseconds linger;   // or this long after its first message
+
+    batch_policy()
+    : max_bytes(16 * 1024), max_messages(256), linger(5)
+    {}
+};
+
+// Packs messages sent through it into message_batch envelopes, one batch per
+// group_id, and sends each envelope through a sender. Messages of one group
+// stay in order and never share an envelope with another group, so group
+// semantics survive. A background thread sends batches that have lingered.
+//
+// Thread safe. Envelopes are sent with the batch lock held, so a send that
+// waits for credit holds up the other sending threads as well, as they would
+// be anyway, and a later batch of a group can never overtake an earlier one.
+class batching_sender
+{
+public:
+    // s must outlive the batching_sender
+    batching_sender(sender& s, const batch_policy& policy = batch_policy());
+    // Sends whatever is still batched
+    ~batching_sender();
+
+    batching_sender(const batching_sender&) = delete;
+    batching_sender& operator=(const batching_sender&) = delete;
+
+    void send(const proton::message& m);
+
+    // Send every batch now
+    void flush();
+
+private:
+    struct pending
+    {
+        message_batch batch;
+        std::chrono::steady_clock::time_point first;
+    };
+
+    void send_batch(pending& p);
+    void run_linger();
+
+    sender& sender_;
+    const batch_policy policy_;
+
+    // Protected by lock_
+    std::mutex lock_;
+    std::unordered_map<std::string, pending> groups_;
+    std::condition_variable wake_;
+    bool stop_;
+
+    std::thread linger_;
+};
+
+#endif /* batching_sender_hpp */
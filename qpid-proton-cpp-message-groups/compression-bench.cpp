@@ -0,0 +1,117 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// What compress_body() buys and costs for each body size: the compressed size
+// as a share of the original, and the time per message to compress on the
+// sending side and to inflate on the receiving side. Bodies are JSON-like
+// text, the kind of payload compression is meant for. Sizes below the
+// threshold are measured too, with the threshold set to 0, to show where
+// compressing stops paying. No broker is needed.
+
+#include "compression.hpp"
+
+#include <proton/message.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace
+{
+    const size_t SIZES[] = { 64, 256, 1024, 4096, 16384, 65536 };
+
+    // Records with repeating keys and varying values, cut to size bytes
+    std::string make_body(size_t size, std::mt19937& rng)
+    {
+        std::uniform_int_distribution<int> value(0, 1000000);
+        std::ostringstream ss;
+        ss << "[";
+        for (int i = 0; ss.tellp() < std::streamoff(size); ++i)
+            ss << "{\"id\":" << i << ",\"group\":\"group" << i % 8 << "\",\"price\":" << value(rng)
+               << ",\"quantity\":" << value(rng) % 100 << ",\"status\":\"open\"},";
+        return ss.str().substr(0, size);
+    }
+
+    // Compresses and inflates n messages of size bytes with policy p,
+    // printing the compressed ratio and nanoseconds per message each way
+    void measure(size_t size, int n, const compression_policy& p, std::mt19937& rng)
+    {
+        const std::string body = make_body(size, rng);
+        std::vector<proton::message> messages(n, proton::message(body));
+        typedef std::chrono::duration<double, std::nano> nanoseconds;
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto& m : messages)
+            compress_body(m, p);
+        nanoseconds compress = std::chrono::steady_clock::now() - start;
+
+        // A body compression would not shrink stays as it is
+        const proton::message& first = messages.front();
+        bool shrunk = std::string(first.content_encoding()) == DEFLATE_ENCODING;
+        size_t compressed = shrunk ? proton::get<proton::binary>(first.body()).size() : size;
+
+        start = std::chrono::steady_clock::now();
+        for (auto& m : messages)
+            decompress_body(m);
+        nanoseconds inflate = std::chrono::steady_clock::now() - start;
+
+        if (proton::get<std::string>(messages.back().body()) != body)
+            throw std::runtime_error("round trip changed the body");
+
+        std::cout << size << "\t" << double(compressed) / size << "\t"
+                  << compress.count() / n << "\t\t" << inflate.count() / n << std::endl;
+    }
+}
+
+int main(int argc, const char **argv) {
+    if (argc > 3) {
+        std::cerr <<
+        "Usage: " << argv[0] << " [MESSAGE-COUNT] [LEVEL]\n"
+        "MESSAGE-COUNT: messages per size, default 10000\n"
+        "LEVEL: zlib level from 1 (fastest) to 9 (smallest), default 1\n";
+        return 1;
+    }
+
+    const int message_count = argc > 1 ? atoi(argv[1]) : 10000;
+    const int level = argc > 2 ? atoi(argv[2]) : 1;
+    if (message_count <= 0 || level < 1 || level > 9) {
+        std::cerr << "MESSAGE-COUNT must be positive and LEVEL from 1 to 9" << std::endl;
+        return 1;
+    }
+
+    std::mt19937 rng(1);
+    const compression_policy policy = compression_policy::deflate(0, level);
+    std::cout << "bytes\tratio\tcompress ns\tinflate ns\n";
+    try {
+        for (size_t size : SIZES)
+            measure(size, message_count, policy, rng);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
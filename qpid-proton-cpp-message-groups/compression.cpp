@@ -0,0 +1,165 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "compression.hpp"
+
+#include <proton/binary.hpp>
+#include <proton/value.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <zlib.h>
+
+
+const char* const DEFLATE_ENCODING = "deflate";
+const char* const COMPRESSED_STRING = "x-menagerie-compressed-string";
+
+namespace
+{
+    bool encoded(const proton::message& m)
+    {
+        return !std::string(m.content_encoding()).empty();
+    }
+
+    template <class Bytes>
+    proton::binary deflate(const Bytes& in, int level)
+    {
+        uLongf size = compressBound(uLong(in.size()));
+        proton::binary out;
+        out.resize(size);
+        if (compress2(reinterpret_cast<Bytef*>(&out[0]), &size, reinterpret_cast<const Bytef*>(in.data()),
+                      uLong(in.size()), level) != Z_OK)
+            throw std::runtime_error("cannot compress message body");
+        out.resize(size);
+        return out;
+    }
+
+    // The compressed size does not say how big the body was, so grow the
+    // output as it fills, but never past max_size: a few KB from a peer can
+    // inflate to gigabytes
+    std::string inflate(const proton::binary& in, size_t max_size)
+    {
+        z_stream z = z_stream();
+        if (inflateInit(&z) != Z_OK)
+            throw std::runtime_error("cannot inflate message body");
+        z.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(in.data()));
+        z.avail_in = uInt(in.size());
+
+        // One byte over max_size is room enough to tell the body is too big
+        const size_t limit = max_size + 1;
+        std::string out(std::min(in.size() * 4 + 64, limit), '\0');
+        int result = Z_OK;
+        while (result == Z_OK)
+        {
+            if (z.total_out == out.size())
+            {
+                if (out.size() == limit)
+                    break;
+                out.resize(std::min(out.size() * 2, limit));
+            }
+            z.next_out = reinterpret_cast<Bytef*>(&out[z.total_out]);
+            z.avail_out = uInt(out.size() - z.total_out);
+            result = ::inflate(&z, Z_NO_FLUSH);
+        }
+        const size_t size = z.total_out;
+        inflateEnd(&z);
+        if (size > max_size)
+            throw std::runtime_error("compressed message body inflates to more than " + std::to_string(max_size) +
+                                     " bytes");
+        out.resize(size);
+        if (result != Z_STREAM_END)
+            throw std::runtime_error("corrupt compressed message body");
+        return out;
+    }
+}
+
+bool compressible(const proton::message& m, const compression_policy& p)
+{
+    if (!p.enabled || encoded(m))
+        return false;
+    const proton::value& body = m.body();
+    switch (body.type())
+    {
+        case proton::STRING:
+            return proton::get<std::string>(body).size() >= p.threshold;
+        case proton::BINARY:
+            return proton::get<proton::binary>(body).size() >= p.threshold;
+        default:
+            return false;
+    }
+}
+
+bool compress_body(proton::message& m, const compression_policy& p)
+{
+    if (!p.enabled || encoded(m))
+        return false;
+    const proton::value& body = m.body();
+    const bool text = body.type() == proton::STRING;
+    if (!text && body.type() != proton::BINARY)
+        return false;
+
+    proton::binary compressed;
+    size_t size = 0;
+    if (text)
+    {
+        const std::string s = proton::get<std::string>(body);
+        if (s.size() < p.threshold)
+            return false;
+        size = s.size();
+        compressed = deflate(s, p.level);
+    }
+    else
+    {
+        const proton::binary b = proton::get<proton::binary>(body);
+        if (b.size() < p.threshold)
+            return false;
+        size = b.size();
+        compressed = deflate(b, p.level);
+    }
+    if (compressed.size() >= size)
+        return false;   // Incompressible, send it as it is
+
+    m.body(compressed);
+    m.content_encoding(DEFLATE_ENCODING);
+    if (text)
+        m.properties().put(COMPRESSED_STRING, true);
+    return true;
+}
+
+bool decompress_body(proton::message& m, size_t max_size)
+{
+    if (std::string(m.content_encoding()) != DEFLATE_ENCODING || m.body().type() != proton::BINARY)
+        return false;
+
+    std::string body = inflate(proton::get<proton::binary>(m.body()), std::min(max_size, MAX_INFLATED_SIZE));
+    proton::message::property_map& properties = m.properties();
+    if (properties.exists(COMPRESSED_STRING))
+    {
+        properties.erase(COMPRESSED_STRING);
+        m.body(body);
+    }
+    else
+    {
+        m.body(proton::binary(body));
+    }
+    m.content_encoding(std::string());
+    return true;
+}
@@ -0,0 +1,71 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef compression_hpp
+#define compression_hpp
+
+#include <proton/message.hpp>
+
+#include <cstddef>
+
+
+// How a sender compresses message bodies. A compressed message carries its
+// body as zlib deflate data in a binary body, with content_encoding
+// DEFLATE_ENCODING, so any AMQP client can tell and undo it. A string body
+// also gets the COMPRESSED_STRING property so it comes back as a string.
+struct compression_policy
+{
+    bool enabled;
+    size_t threshold;       // Bodies smaller than this are sent as they are
+    int level;              // zlib level, 1 fastest to 9 smallest
+
+    compression_policy()
+    : enabled(false), threshold(1024), level(1)
+    {}
+
+    static compression_policy deflate(size_t threshold = 1024, int level = 1)
+    {
+        compression_policy p;
+        p.enabled = true;
+        p.threshold = threshold;
+        p.level = level;
+        return p;
+    }
+};
+
+extern const char* const DEFLATE_ENCODING;
+extern const char* const COMPRESSED_STRING;
+
+// The most any body is inflated to, whatever the caller allows
+const size_t MAX_INFLATED_SIZE = size_t(256) << 20;
+
+// Whether compress_body() would try m: p is enabled, m is not already
+// encoded and has a string or binary body of at least p.threshold bytes
+bool compressible(const proton::message& m, const compression_policy& p);
+
+// Compresses m's body if it is compressible() and compressing makes it
+// smaller. Returns whether it did.
+bool compress_body(proton::message& m, const compression_policy& p);
+
+// Undoes compress_body(), returns false if m was not compressed. Throws
+// std::runtime_error if the body cannot be inflated or would inflate to more
+// than max_size bytes.
+bool decompress_body(proton::message& m, size_t max_size = MAX_INFLATED_SIZE);
+
+#endif /* compression_hpp */
@@ -0,0 +1,124 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "credit_controller.hpp"
+
+#include <algorithm>
+
+
+namespace
+{
+    const size_t INITIAL_WINDOW = 100;              // Where we start before anything is measured
+    const double RATE_WEIGHT = 0.25;                // EWMA weight of a new consume rate sample
+    const std::chrono::milliseconds MIN_SAMPLE(10); // Shorter intervals make for a noisy rate
+
+    size_t clamp(size_t v, size_t lo, size_t hi)
+    {
+        return std::max(lo, std::min(v, hi));
+    }
+}
+
+memory_budget& memory_budget::process()
+{
+    static memory_budget budget;
+    return budget;
+}
+
+size_t memory_budget::available() const
+{
+    size_t ceiling = ceiling_.load(std::memory_order_relaxed);
+    if (ceiling == 0)
+        return SIZE_MAX;
+    size_t used = used_.load(std::memory_order_relaxed);
+    return ceiling > used ? ceiling - used : 0;
+}
+
+credit_controller::credit_controller(const credit_limits& limits)
+: limits_(limits), awaiting_first_(false), last_consumed_(0), last_sample_(clock::now()),
+  rate_(0), rtt_(0), avg_size_(HEADER_OVERHEAD), window_(0), low_water_(0)
+{
+    window_ = clamp(INITIAL_WINDOW, limits_.min_messages, limits_.max_messages);
+    update_window();
+}
+
+void credit_controller::credit_granted(size_t n, size_t link_credit, clock::time_point now)
+{
+    // Only a link with no credit left measures the round trip, otherwise
+    // messages already on their way would arrive early.
+    if (n > 0 && link_credit == 0 && !awaiting_first_)
+    {
+        awaiting_first_ = true;
+        granted_at_ = now;
+    }
+}
+
+void credit_controller::message_arrived(size_t bytes, clock::time_point now)
+{
+    size_t avg = avg_size_.load(std::memory_order_relaxed);
+    avg_size_.store(avg - avg / 16 + bytes / 16, std::memory_order_relaxed);
+
+    if (awaiting_first_)
+    {
+        awaiting_first_ = false;
+        double sample = std::chrono::duration<double>(now - granted_at_).count();
+        double rtt = rtt_.load(std::memory_order_relaxed);
+        // An idle source inflates samples, so follow decreases immediately and
+        // increases slowly.
+        if (rtt == 0 || sample < rtt)
+            rtt = sample;
+        else
+            rtt += (sample - rtt) / 8;
+        rtt_.store(rtt, std::memory_order_relaxed);
+        update_window();
+    }
+}
+
+void credit_controller::sample_consumption(size_t consumed, clock::time_point now)
+{
+    auto elapsed = now - last_sample_;
+    if (elapsed < MIN_SAMPLE)
+        return;
+
+    double sample = (consumed - last_consumed_) / std::chrono::duration<double>(elapsed).count();
+    double rate = rate_.load(std::memory_order_relaxed);
+    rate_.store(rate == 0 ? sample : rate + RATE_WEIGHT * (sample - rate), std::memory_order_relaxed);
+    last_consumed_ = consumed;
+    last_sample_ = now;
+    update_window();
+}
+
+void credit_controller::update_window()
+{
+    size_t window = window_.load(std::memory_order_relaxed);
+    double rate = rate_.load(std::memory_order_relaxed);
+    double rtt = rtt_.load(std::memory_order_relaxed);
+
+    // Keep the current window until there is something to go on
+    if (rate > 0 && rtt > 0)
+        window = size_t(2 * rate * rtt) + 1;
+
+    size_t avg = std::max<size_t>(1, avg_size_.load(std::memory_order_relaxed));
+    window = clamp(window, limits_.min_messages, limits_.max_messages);
+    window = std::max(window, limits_.min_bytes / avg);
+    window = std::min(window, std::min(limits_.max_bytes / avg, limits_.max_messages));
+    window = std::max<size_t>(window, 1);
+
+    window_.store(window, std::memory_order_relaxed);
+    low_water_.store(std::max<size_t>(1, size_t(window * limits_.low_water)), std::memory_order_relaxed);
+}
@@ -0,0 +1,126 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef credit_controller_hpp
+#define credit_controller_hpp
+
+#include "message_size.hpp"
+
+#include <proton/message.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+// Bounds on the credit window, in both messages and bytes. When the two
+// disagree the upper bounds win.
+struct credit_limits
+{
+    size_t min_messages;
+    size_t max_messages;    // Also the receiver's buffer capacity
+    size_t min_bytes;
+    size_t max_bytes;       // Also caps the bytes a receiver buffers plus those credit is out for
+    double low_water;       // Fraction of the window below which credit is replenished
+
+    credit_limits()
+    : min_messages(10), max_messages(1000), min_bytes(0), max_bytes(16 * 1024 * 1024), low_water(0.5)
+    {}
+};
+
+// Memory held in buffered messages by every receiver in the process, with an
+// optional ceiling. Receivers grant no credit that would take the total over
+// the ceiling, so one flooded receiver cannot starve the others of memory.
+//
+// Thread safe.
+class memory_budget
+{
+public:
+    static memory_budget& process();
+
+    // 0, the default, is no ceiling
+    void ceiling(size_t bytes) { ceiling_.store(bytes, std::memory_order_relaxed); }
+    size_t ceiling() const { return ceiling_.load(std::memory_order_relaxed); }
+    size_t used() const { return used_.load(std::memory_order_relaxed); }
+
+    // Bytes left under the ceiling, SIZE_MAX if there is none
+    size_t available() const;
+
+    void acquire(size_t bytes) { used_.fetch_add(bytes, std::memory_order_relaxed); }
+    void release(size_t bytes) { used_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+private:
+    memory_budget() : ceiling_(0), used_(0) {}
+
+    std::atomic<size_t> ceiling_;
+    std::atomic<size_t> used_;
+};
+
+// Sizes the credit window of a receiver to roughly consume rate x round trip
+// time, the number of messages that must be in flight to keep a consumer busy
+// without buffering more than it will get to within one round trip.
+//
+// The round trip time is sampled from credit being issued to a starved link
+// until the first message arrives. The window is twice rate x RTT so that a
+// window which is itself limiting the rate can grow.
+//
+// Updated on the proton thread only, the accessors are safe from any thread.
+class credit_controller
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit credit_controller(const credit_limits& limits);
+
+    const credit_limits& limits() const { return limits_; }
+
+    // ==== Called by the proton thread only
+    // n credits were issued, link_credit is what the link had before
+    void credit_granted(size_t n, size_t link_credit, clock::time_point now);
+    void message_arrived(size_t bytes, clock::time_point now);
+    // consumed is the total number of messages consumed so far
+    void sample_consumption(size_t consumed, clock::time_point now);
+
+    // ==== Thread safe
+    size_t window() const { return window_.load(std::memory_order_relaxed); }
+    size_t low_water() const { return low_water_.load(std::memory_order_relaxed); }
+    double consume_rate() const { return rate_.load(std::memory_order_relaxed); }     // messages per second
+    double round_trip() const { return rtt_.load(std::memory_order_relaxed); }        // seconds
+    size_t average_size() const { return avg_size_.load(std::memory_order_relaxed); } // bytes
+
+private:
+    void update_window();
+
+    const credit_limits limits_;
+
+    // Used in proton threads only
+    bool awaiting_first_;               // Credit was issued to a starved link
+    clock::time_point granted_at_;
+    size_t last_consumed_;
+    clock::time_point last_sample_;
+
+    std::atomic<double> rate_;
+    std::atomic<double> rtt_;
+    std::atomic<size_t> avg_size_;
+    std::atomic<size_t> window_;
+    std::atomic<size_t> low_water_;
+};
+
+#endif /* credit_controller_hpp */
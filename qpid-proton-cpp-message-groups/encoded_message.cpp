@@ -0,0 +1,107 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "encoded_message.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+
+namespace
+{
+    const char MAGIC[] = "MENCORP1";
+    const size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+}
+
+encoded_message::encoded_message(const proton::message& m)
+{
+    auto bytes = std::make_shared<std::vector<char> >();
+    m.encode(*bytes);
+    data_ = bytes->data();
+    size_ = bytes->size();
+    owner_ = bytes;
+}
+
+encoded_message::encoded_message(std::vector<char>&& bytes)
+{
+    auto owned = std::make_shared<const std::vector<char> >(std::move(bytes));
+    data_ = owned->data();
+    size_ = owned->size();
+    owner_ = owned;
+}
+
+proton::message encoded_message::decode() const
+{
+    proton::message m;
+    if (size_)
+        m.decode(std::vector<char>(data_, data_ + size_));
+    return m;
+}
+
+std::vector<encoded_message> load_corpus(const std::string& path)
+{
+    std::ifstream f(path.c_str(), std::ios::binary);
+    if (!f)
+        throw std::runtime_error("cannot open corpus " + path);
+
+    // A header may not claim more bytes than are left in the file
+    f.seekg(0, std::ios::end);
+    const std::streamoff file_size = f.tellg();
+    f.seekg(0, std::ios::beg);
+
+    char magic[MAGIC_SIZE];
+    if (!f.read(magic, MAGIC_SIZE) || std::memcmp(magic, MAGIC, MAGIC_SIZE) != 0)
+        throw std::runtime_error(path + " is not a corpus");
+
+    std::vector<encoded_message> corpus;
+    unsigned char header[4];
+    while (f.read(reinterpret_cast<char*>(header), sizeof(header)))
+    {
+        size_t size = size_t(header[0]) << 24 | size_t(header[1]) << 16 | size_t(header[2]) << 8 | header[3];
+        if (std::streamoff(size) > file_size - f.tellg())
+            throw std::runtime_error("truncated corpus " + path);
+        std::vector<char> bytes(size);
+        if (!f.read(bytes.data(), std::streamsize(size)))
+            throw std::runtime_error("truncated corpus " + path);
+        corpus.push_back(encoded_message(std::move(bytes)));
+    }
+    if (f.gcount() != 0)
+        throw std::runtime_error("truncated corpus " + path);
+    return corpus;
+}
+
+void save_corpus(const std::string& path, const std::vector<encoded_message>& corpus)
+{
+    std::ofstream f(path.c_str(), std::ios::binary | std::ios::trunc);
+    f.write(MAGIC, MAGIC_SIZE);
+    for (auto& m : corpus)
+    {
+        if (m.size() > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("message too big for corpus " + path);
+        uint32_t size = uint32_t(m.size());
+        unsigned char header[4] = { uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size) };
+        f.write(reinterpret_cast<const char*>(header), sizeof(header));
+        f.write(m.data(), std::streamsize(m.size()));
+    }
+    if (!f)
+        throw std::runtime_error("cannot write corpus " + path);
+}
@@ -0,0 +1,66 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef encoded_message_hpp
+#define encoded_message_hpp
+
+#include <proton/message.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// A message encoded once, as it goes on the wire, for sending any number of
+// times over any number of links without encoding it again. Immutable, so
+// copies share the one buffer and can be used from any thread.
+class encoded_message
+{
+    std::shared_ptr<const void> owner_;    // Keeps data_ valid
+    const char* data_;
+    size_t size_;
+
+public:
+    encoded_message() : data_(0), size_(0) {}
+    explicit encoded_message(const proton::message& m);
+    // bytes must already be an encoded message
+    explicit encoded_message(std::vector<char>&& bytes);
+    // Refers to size bytes at data without copying them, for example in a
+    // mapped file, data must stay valid for as long as owner lives
+    encoded_message(std::shared_ptr<const void> owner, const char* data, size_t size)
+    : owner_(std::move(owner)), data_(data), size_(size)
+    {}
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    proton::message decode() const;
+};
+
+// A corpus file is the 8 bytes "MENCORP1" followed by each message as its
+// size, a 4 byte big endian integer, and then its encoded bytes.
+//
+// Both throw std::runtime_error if the file cannot be read or written, or
+// is not a corpus.
+std::vector<encoded_message> load_corpus(const std::string& path);
+void save_corpus(const std::string& path, const std::vector<encoded_message>& corpus);
+
+#endif /* encoded_message_hpp */
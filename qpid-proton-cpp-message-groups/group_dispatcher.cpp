@@ -0,0 +1,167 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "group_dispatcher.hpp"
+#include "receiver.hpp"
+
+#include <algorithm>
+
+
+namespace
+{
+    // A group's hashed shard is passed over when it is deeper than this
+    // many times the least loaded one
+    const size_t IMBALANCE = 2;
+}
+
+group_dispatcher::group_dispatcher(receiver& r, size_t shards, handler h, size_t batch)
+: receiver_(r), handler_(h), batch_(std::max<size_t>(1, batch)), stopping_(false)
+{
+    for (size_t i = 0; i < std::max<size_t>(1, shards); ++i)
+        shards_.push_back(std::unique_ptr<shard>(new shard()));
+    for (auto& s : shards_)
+    {
+        shard& sh = *s;
+        sh.thread = std::thread([this, &sh]() { this->work(sh); });
+    }
+    pump_ = std::thread([this]() { this->pump(); });
+}
+
+group_dispatcher::~group_dispatcher()
+{
+    stop();
+}
+
+void group_dispatcher::stop()
+{
+    std::lock_guard<std::mutex> l(stop_lock_);
+    if (!pump_.joinable())
+        return;
+
+    stopping_ = true;
+    pump_.join();
+    for (auto& s : shards_)
+    {
+        {
+            std::lock_guard<std::mutex> sl(s->lock);
+            s->stopping = true;
+        }
+        s->ready.notify_one();
+        s->thread.join();
+    }
+}
+
+size_t group_dispatcher::groups() const
+{
+    std::lock_guard<std::mutex> l(affinity_lock_);
+    return affinity_.size();
+}
+
+// Pull batches from the receiver and hand each message to its shard
+void group_dispatcher::pump()
+{
+    std::vector<proton::message> batch;
+    batch.reserve(batch_);
+    while (!stopping_)
+    {
+        batch.clear();
+        // Time out now and then to notice stop()
+        if (receiver_.receive_batch(batch, batch_, 1) == 0)
+            continue;
+
+        for (auto& m : batch)
+        {
+            shard& s = *shards_[place(m)];
+            {
+                std::lock_guard<std::mutex> l(s.lock);
+                s.queue.push_back(std::move(m));
+                ++s.depth;
+            }
+            s.ready.notify_one();
+        }
+    }
+}
+
+// Choose the shard for m, binding its group if it is not already bound
+size_t group_dispatcher::place(const proton::message& m)
+{
+    std::string group_id = m.group_id();
+    if (group_id.empty())
+        return least_loaded();
+
+    std::lock_guard<std::mutex> l(affinity_lock_);
+    auto it = affinity_.find(group_id);
+    if (it == affinity_.end())
+    {
+        size_t hashed = std::hash<std::string>()(group_id) % shards_.size();
+        size_t least = least_loaded();
+        size_t chosen = shards_[hashed]->depth > IMBALANCE * (shards_[least]->depth + 1) ? least : hashed;
+        affinity a = { chosen, 0, false };
+        it = affinity_.insert(std::make_pair(group_id, a)).first;
+    }
+
+    affinity& a = it->second;
+    ++a.outstanding;
+    if (m.group_sequence() == -1)
+        a.ended = true;
+    return a.shard;
+}
+
+size_t group_dispatcher::least_loaded() const
+{
+    size_t least = 0;
+    for (size_t i = 1; i < shards_.size(); ++i)
+    {
+        if (shards_[i]->depth < shards_[least]->depth)
+            least = i;
+    }
+    return least;
+}
+
+// Run messages of one shard in order until stopped and drained
+void group_dispatcher::work(shard& s)
+{
+    proton::message m;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> l(s.lock);
+            while (s.queue.empty() && !s.stopping) s.ready.wait(l);
+            if (s.queue.empty())
+                return;
+            m = std::move(s.queue.front());
+            s.queue.pop_front();
+            --s.depth;
+        }
+
+        std::string group_id = m.group_id();
+        handler_(m);
+        if (!group_id.empty())
+            handled(group_id);
+    }
+}
+
+// Release a group's shard once its end marker and everything before it are done
+void group_dispatcher::handled(const std::string& group_id)
+{
+    std::lock_guard<std::mutex> l(affinity_lock_);
+    auto it = affinity_.find(group_id);
+    if (it != affinity_.end() && --it->second.outstanding == 0 && it->second.ended)
+        affinity_.erase(it);
+}
@@ -0,0 +1,105 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef group_dispatcher_hpp
+#define group_dispatcher_hpp
+
+#include <proton/message.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class receiver;
+
+
+// Pulls messages from a receiver and runs them on a fixed set of worker
+// shards, one thread each. All messages of a group go to the same shard so
+// they are handled in order, while different groups run in parallel.
+//
+// A group is bound to a shard by hashing its group_id when its first message
+// is seen, unless that shard is backed up in which case the least loaded
+// shard is used. The binding is released once the group end marker
+// (group_sequence() == -1) and everything before it have been handled, so
+// the next instance of that group id can be placed afresh. Messages without
+// a group_id go to the least loaded shard.
+class group_dispatcher
+{
+public:
+    typedef std::function<void(proton::message&)> handler;
+
+    // Starts pulling from r at once, up to batch messages at a time
+    group_dispatcher(receiver& r, size_t shards, handler h, size_t batch = 64);
+    ~group_dispatcher();
+
+    // Stop pulling from the receiver, finish what the shards already have and
+    // join all threads. Thread safe, idempotent.
+    void stop();
+
+    size_t shards() const { return shards_.size(); }
+    size_t groups() const;   // Groups currently bound to a shard
+
+private:
+    struct shard
+    {
+        std::mutex lock;
+        std::condition_variable ready;
+        std::deque<proton::message> queue;
+        std::atomic<size_t> depth;          // queue.size(), read without lock
+        bool stopping;
+        std::thread thread;
+
+        shard() : depth(0), stopping(false) {}
+    };
+
+    struct affinity
+    {
+        size_t shard;
+        size_t outstanding;                 // Dispatched but not yet handled
+        bool ended;                         // The group end marker was dispatched
+    };
+
+    void pump();
+    void work(shard& s);
+    size_t place(const proton::message& m);
+    size_t least_loaded() const;
+    void handled(const std::string& group_id);
+
+    receiver& receiver_;
+    const handler handler_;
+    const size_t batch_;
+    std::vector<std::unique_ptr<shard> > shards_;
+
+    // Shared by the pump and the shard threads, protected by affinity_lock_
+    mutable std::mutex affinity_lock_;
+    std::unordered_map<std::string, affinity> affinity_;
+
+    std::atomic<bool> stopping_;
+    std::mutex stop_lock_;
+    std::thread pump_;
+};
+
+#endif /* group_dispatcher_hpp */
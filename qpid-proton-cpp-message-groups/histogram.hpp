@@ -0,0 +1,163 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef histogram_hpp
+#define histogram_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+
+// A log-linear histogram of non-negative integer values, typically
+// nanoseconds. Every power of two is split into 64 linear buckets, so a
+// recorded value is reported within about 1.6% of what it was, from 0 up to
+// 2^64 - 1, in a fixed 30KB.
+//
+// record() is thread safe and lock free, a relaxed atomic increment.
+// Reading while others record gives a consistent enough snapshot for
+// monitoring.
+class histogram
+{
+    static const int SUB_BITS = 6;
+    static const uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;   // Buckets per power of two
+    static const uint64_t LINEAR = 2 * SUB_COUNT;                // Values below this have a bucket each
+    static const size_t BUCKETS = LINEAR + (64 - SUB_BITS - 1) * SUB_COUNT;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> total_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> min_;
+    std::atomic<uint64_t> max_;
+
+    static int log2(uint64_t v)
+    {
+        int n = 0;
+        while (v >>= 1) ++n;
+        return n;
+    }
+
+    static size_t index(uint64_t v)
+    {
+        if (v < LINEAR)
+            return size_t(v);
+        int e = log2(v);                                    // >= SUB_BITS + 1
+        int shift = e - SUB_BITS;
+        return size_t(LINEAR + uint64_t(e - SUB_BITS - 1) * SUB_COUNT + ((v >> shift) - SUB_COUNT));
+    }
+
+    // Highest value that lands in bucket i
+    static uint64_t upper(size_t i)
+    {
+        if (i < LINEAR)
+            return i;
+        uint64_t e = (i - LINEAR) / SUB_COUNT + SUB_BITS + 1;
+        uint64_t sub = (i - LINEAR) % SUB_COUNT + SUB_COUNT;
+        int shift = int(e) - SUB_BITS;
+        return ((sub + 1) << shift) - 1;
+    }
+
+public:
+    histogram()
+    : counts_(new std::atomic<uint64_t>[BUCKETS]), total_(0), sum_(0), min_(UINT64_MAX), max_(0)
+    {
+        reset();
+    }
+
+    histogram(const histogram&) = delete;
+    histogram& operator=(const histogram&) = delete;
+
+    // Thread safe
+    void record(uint64_t v)
+    {
+        counts_[index(v)].fetch_add(1, std::memory_order_relaxed);
+        total_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(v, std::memory_order_relaxed);
+        uint64_t m = min_.load(std::memory_order_relaxed);
+        while (v < m && !min_.compare_exchange_weak(m, v, std::memory_order_relaxed));
+        m = max_.load(std::memory_order_relaxed);
+        while (v > m && !max_.compare_exchange_weak(m, v, std::memory_order_relaxed));
+    }
+
+    // Add everything recorded in other
+    void merge(const histogram& other)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            uint64_t c = other.counts_[i].load(std::memory_order_relaxed);
+            if (c)
+                counts_[i].fetch_add(c, std::memory_order_relaxed);
+        }
+        total_.fetch_add(other.count(), std::memory_order_relaxed);
+        sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        uint64_t v = other.min_.load(std::memory_order_relaxed);
+        uint64_t m = min_.load(std::memory_order_relaxed);
+        while (v < m && !min_.compare_exchange_weak(m, v, std::memory_order_relaxed));
+        v = other.max();
+        m = max_.load(std::memory_order_relaxed);
+        while (v > m && !max_.compare_exchange_weak(m, v, std::memory_order_relaxed));
+    }
+
+    void reset()
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+            counts_[i].store(0, std::memory_order_relaxed);
+        total_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        min_.store(UINT64_MAX, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+    uint64_t min() const { return count() ? min_.load(std::memory_order_relaxed) : 0; }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    double mean() const { return count() ? double(sum_.load(std::memory_order_relaxed)) / count() : 0; }
+
+    // Value at or below which p percent of recorded values fall
+    uint64_t percentile(double p) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+        uint64_t rank = uint64_t(p / 100.0 * total + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return upper(i) < max() ? upper(i) : max();
+        }
+        return max();
+    }
+
+    // One line summary, values divided by scale and followed by unit
+    void print(std::ostream& o, double scale = 1000.0, const char* unit = "us") const
+    {
+        o << "count " << count()
+          << " mean " << mean() / scale << unit
+          << " p50 " << percentile(50) / scale << unit
+          << " p99 " << percentile(99) / scale << unit
+          << " p99.9 " << percentile(99.9) / scale << unit
+          << " max " << max() / scale << unit;
+    }
+};
+
+#endif /* histogram_hpp */
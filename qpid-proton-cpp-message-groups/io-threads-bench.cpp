@@ -0,0 +1,138 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Aggregate throughput against the number of threads running one container.
+// Each run opens CONNECTIONS sender and CONNECTIONS receiver connections on
+// the container, drives every sender from its own thread and drains every
+// receiver from its own thread, and is timed until all messages have been
+// received. Encoding and decoding happen on the container threads, so with
+// enough connections throughput should grow with the I/O thread count.
+
+#include "receiver.hpp"
+#include "sender.hpp"
+
+#include <proton/container.hpp>
+#include <proton/message.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Returns messages per second for io_threads threads running the container
+static double run(const std::string& url, const std::string& address, int io_threads, int connections, int n)
+{
+    proton::container container;
+    auto container_thread = std::thread([&]() { container.run(io_threads); });
+    
+    std::vector<std::unique_ptr<sender> > senders;
+    std::vector<std::unique_ptr<receiver> > receivers;
+    for (int i = 0; i < connections; ++i)
+    {
+        senders.push_back(std::unique_ptr<sender>(new sender(container, url, address)));
+        receivers.push_back(std::unique_ptr<receiver>(new receiver(container, url, address)));
+    }
+    
+    const int per_sender = n / connections;
+    const int total = per_sender * connections;
+    std::atomic<int> received(0);
+    std::vector<std::thread> threads;
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < connections; ++i)
+    {
+        sender& s = *senders[i];
+        threads.push_back(std::thread([&s, per_sender]() {
+            const int batch = 1000;
+            for (int sent = 0; sent < per_sender; sent += batch)
+            {
+                std::vector<proton::message> messages;
+                for (int k = sent; k < std::min(per_sender, sent + batch); ++k)
+                    messages.push_back(proton::message(std::to_string(k)));
+                s.send_batch(std::move(messages));
+            }
+        }));
+        
+        receiver& r = *receivers[i];
+        threads.push_back(std::thread([&r, &received, total]() {
+            std::vector<proton::message> messages;
+            while (received < total)
+            {
+                messages.clear();
+                received += int(r.receive_batch(messages, 1000, 1));
+            }
+        }));
+    }
+    for (auto& t : threads)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    for (int i = 0; i < connections; ++i)
+    {
+        senders[i]->close();
+        receivers[i]->close();
+    }
+    container_thread.join();
+    
+    return total / elapsed.count();
+}
+
+int main(int argc, const char **argv) {
+    try {
+        if (argc < 3 || argc > 6) {
+            std::cerr <<
+            "Usage: " << argv[0] << " CONNECTION-URL AMQP-ADDRESS [MESSAGE-COUNT] [CONNECTIONS] [MAX-IO-THREADS]\n"
+            "CONNECTION-URL: connection address, e.g.'amqp://127.0.0.1'\n"
+            "AMQP-ADDRESS: AMQP node address, e.g. 'examples'\n"
+            "MESSAGE-COUNT: messages per run, default 200000\n"
+            "CONNECTIONS: sender and receiver connections each, default 8\n"
+            "MAX-IO-THREADS: largest container thread count tried, default 8\n";
+            return 1;
+        }
+        
+        const std::string url = argv[1];
+        const std::string address = argv[2];
+        const int message_count = argc > 3 ? atoi(argv[3]) : 200000;
+        const int connections = argc > 4 ? std::max(1, atoi(argv[4])) : 8;
+        const int max_threads = argc > 5 ? std::max(1, atoi(argv[5])) : 8;
+        
+        double base = 0;
+        std::cout << "io-threads  msgs/s  scaling\n";
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double rate = run(url, address, threads, connections, message_count);
+            if (threads == 1)
+                base = rate;
+            std::cout << threads << "\t    " << int(rate) << "\t" << rate / base << "x" << std::endl;
+        }
+        
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -0,0 +1,81 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Sends every message in a journal, in the order it was received, as fast as
+// the broker gives credit. Messages go to the link straight from the mapped
+// journal segments, they are neither copied nor decoded on the way.
+
+#include "journal.hpp"
+#include "sender.hpp"
+
+#include <proton/container.hpp>
+#include <proton/delivery_mode.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+
+int main(int argc, const char **argv) {
+    try {
+        if (argc < 4 || argc > 5) {
+            std::cerr <<
+            "Usage: " << argv[0] << " CONNECTION-URL AMQP-ADDRESS JOURNAL-DIR [PRESETTLED]\n"
+            "CONNECTION-URL: connection address, e.g.'amqp://127.0.0.1'\n"
+            "AMQP-ADDRESS: AMQP node address, e.g. 'examples'\n"
+            "JOURNAL-DIR: directory of a journal written by a receiver\n"
+            "PRESETTLED: 1 to send at most once, default 0\n";
+            return 1;
+        }
+
+        const std::string url = argv[1];
+        const std::string address = argv[2];
+        const bool presettled = argc > 4 && atoi(argv[4]) > 0;
+
+        journal_reader reader(argv[3]);
+
+        proton::container container;
+        auto container_thread = std::thread([&]() { container.run(); });
+        sender send(container, url, address,
+                    presettled ? proton::delivery_mode::AT_MOST_ONCE : proton::delivery_mode::AT_LEAST_ONCE);
+
+        size_t count = 0;
+        encoded_message m;
+        auto start = std::chrono::steady_clock::now();
+        while (reader.next(m))
+        {
+            send.send(m);
+            ++count;
+        }
+        send.close();
+        container_thread.join();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "replayed " << count << " messages in " << elapsed.count() << "s, "
+                  << int(count / elapsed.count()) << " msgs/s" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}
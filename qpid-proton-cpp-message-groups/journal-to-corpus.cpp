@@ -0,0 +1,65 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Writes the messages of a journal, in the order they were received, to a
+// corpus file for menagerie-bench --api encoded --corpus to replay. The
+// journal's encoded bytes are written as they are, nothing is decoded.
+
+#include "encoded_message.hpp"
+#include "journal.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+int main(int argc, const char **argv) {
+    try {
+        if (argc < 3 || argc > 4) {
+            std::cerr <<
+            "Usage: " << argv[0] << " JOURNAL-DIR CORPUS-FILE [MAX-MESSAGES]\n"
+            "JOURNAL-DIR: directory of a journal written by a receiver\n"
+            "CORPUS-FILE: corpus to write, replaced if it exists\n"
+            "MAX-MESSAGES: stop after this many messages, default 0 for all\n";
+            return 1;
+        }
+
+        const size_t max = argc > 3 ? size_t(std::max(0, atoi(argv[3]))) : 0;
+
+        journal_reader reader(argv[1]);
+        std::vector<encoded_message> corpus;
+        encoded_message m;
+        while ((max == 0 || corpus.size() < max) && reader.next(m))
+            corpus.push_back(m);
+        if (corpus.empty())
+            throw std::runtime_error(std::string("no messages in journal ") + argv[1]);
+
+        save_corpus(argv[2], corpus);
+        std::cout << "wrote " << corpus.size() << " messages to " << argv[2] << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}
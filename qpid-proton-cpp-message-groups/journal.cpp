@@ -0,0 +1,280 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "journal.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace
+{
+    const char MAGIC[] = "MENJRNL1";
+    const size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+    const size_t HEADER_SIZE = 4;
+    const char SUFFIX[] = ".jnl";
+
+    std::runtime_error failure(const std::string& what, const std::string& path)
+    {
+        return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+    }
+
+    std::string segment_path(const std::string& dir, size_t index)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%08zu%s", index, SUFFIX);
+        return dir + name;
+    }
+
+    size_t read_size(const char* p)
+    {
+        const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+        return size_t(u[0]) << 24 | size_t(u[1]) << 16 | size_t(u[2]) << 8 | u[3];
+    }
+
+    void write_size(char* p, size_t size)
+    {
+        p[0] = char(size >> 24);
+        p[1] = char(size >> 16);
+        p[2] = char(size >> 8);
+        p[3] = char(size);
+    }
+
+    // The end of the last whole record in a segment of size bytes
+    size_t scan(const char* base, size_t size)
+    {
+        size_t offset = MAGIC_SIZE;
+        while (offset + HEADER_SIZE <= size)
+        {
+            size_t n = read_size(base + offset);
+            if (n == 0 || n > size - offset - HEADER_SIZE)
+                break;
+            offset += HEADER_SIZE + n;
+        }
+        return offset;
+    }
+}
+
+journal::journal(const std::string& dir, size_t segment_size, std::chrono::milliseconds sync_interval)
+: dir_(dir), segment_size_(std::max(segment_size, MAGIC_SIZE + HEADER_SIZE + 1)), sync_interval_(sync_interval),
+  index_(0), written_(0), synced_(0), stop_(false), appended_(0)
+{
+    ::mkdir(dir_.c_str(), 0755);
+
+    // Carry on in the last segment there is
+    while (::access(segment_path(dir_, index_ + 1).c_str(), F_OK) == 0)
+        ++index_;
+    open_segment(index_);
+
+    syncer_ = std::thread([this]() { run_syncer(); });
+}
+
+journal::~journal()
+{
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    syncer_.join();
+    sync();
+}
+
+// Called with lock_ held, or before the syncer starts
+void journal::open_segment(size_t index)
+{
+    std::string path = segment_path(dir_, index);
+    auto segment = std::make_shared<mapped_file>(path, true, segment_size_);
+    char* base = segment->data();
+
+    if (std::memcmp(base, MAGIC, MAGIC_SIZE) == 0)
+    {
+        written_ = scan(base, segment->size());
+    }
+    else
+    {
+        std::memcpy(base, MAGIC, MAGIC_SIZE);
+        written_ = MAGIC_SIZE;
+    }
+    synced_ = 0;
+    index_ = index;
+    segment_ = segment;
+}
+
+// Called with lock_ held, moves on to a segment with room for need bytes
+void journal::roll(size_t need)
+{
+    retired_.push_back(std::make_pair(segment_, written_));
+    if (need + MAGIC_SIZE > segment_size_)
+    {
+        // Too big for any segment, give it one of its own
+        std::string path = segment_path(dir_, index_ + 1);
+        auto segment = std::make_shared<mapped_file>(path, true, need + MAGIC_SIZE + HEADER_SIZE);
+        std::memcpy(segment->data(), MAGIC, MAGIC_SIZE);
+        segment_ = segment;
+        index_ += 1;
+        written_ = MAGIC_SIZE;
+        synced_ = 0;
+    }
+    else
+    {
+        open_segment(index_ + 1);
+    }
+    wake_.notify_all();
+}
+
+void journal::append(const proton::message& m)
+{
+    // Encode outside the lock, into a buffer each thread keeps
+    static thread_local std::vector<char> bytes;
+    m.encode(bytes);
+    append(bytes.data(), bytes.size());
+}
+
+void journal::append(const char* data, size_t size)
+{
+    if (size == 0)
+        return;
+
+    std::lock_guard<std::mutex> l(lock_);
+    const size_t need = HEADER_SIZE + size;
+    // Leave room for the zero size that ends the segment
+    if (written_ + need + HEADER_SIZE > segment_->size())
+        roll(need);
+
+    char* p = segment_->data() + written_;
+    std::memcpy(p + HEADER_SIZE, data, size);
+    // End the segment after this record. A segment reopened after a torn
+    // write may hold stale bytes there that would otherwise read as a size.
+    write_size(p + need, 0);
+    // The size goes last so a record is whole once it is visible
+    std::atomic_thread_fence(std::memory_order_release);
+    write_size(p, size);
+    written_ += need;
+    ++appended_;
+}
+
+void journal::sync()
+{
+    std::vector<std::pair<std::shared_ptr<mapped_file>, size_t> > retired;
+    std::shared_ptr<mapped_file> segment;
+    size_t from, to;
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        retired.swap(retired_);
+        segment = segment_;
+        from = synced_;
+        to = written_;
+    }
+
+    // Segments are unmapped as the last reference to them goes, here for
+    // full ones
+    for (auto& r : retired)
+        r.first->sync(0, r.second);
+    segment->sync(from, to);
+
+    std::lock_guard<std::mutex> l(lock_);
+    if (segment == segment_)
+        synced_ = std::max(synced_, to);
+}
+
+void journal::run_syncer()
+{
+    std::unique_lock<std::mutex> l(lock_);
+    while (!stop_)
+    {
+        wake_.wait_for(l, sync_interval_);
+        if (stop_)
+            break;
+        bool dirty = !retired_.empty() || written_ > synced_;
+        if (dirty)
+        {
+            l.unlock();
+            sync();
+            l.lock();
+        }
+    }
+}
+
+journal_reader::journal_reader(const std::string& dir)
+: dir_(dir), file_(0), offset_(0)
+{
+    DIR* d = ::opendir(dir_.c_str());
+    if (!d)
+        throw failure("cannot open journal", dir_);
+    const size_t suffix = sizeof(SUFFIX) - 1;
+    while (struct dirent* e = ::readdir(d))
+    {
+        std::string name = e->d_name;
+        if (name.size() > suffix && name.compare(name.size() - suffix, suffix, SUFFIX) == 0)
+            files_.push_back(dir_ + "/" + name);
+    }
+    ::closedir(d);
+    // Zero padded, so in the order they were written
+    std::sort(files_.begin(), files_.end());
+}
+
+bool journal_reader::open_next()
+{
+    while (file_ < files_.size())
+    {
+        const std::string& path = files_[file_++];
+        auto segment = std::make_shared<mapped_file>(path, false);
+        if (segment->size() < MAGIC_SIZE || std::memcmp(segment->data(), MAGIC, MAGIC_SIZE) != 0)
+            throw std::runtime_error(path + " is not a journal segment");
+        segment_ = segment;
+        offset_ = MAGIC_SIZE;
+        return true;
+    }
+    segment_.reset();
+    return false;
+}
+
+bool journal_reader::next(encoded_message& m)
+{
+    for (;;)
+    {
+        if (!segment_ && !open_next())
+            return false;
+
+        const char* base = segment_->data();
+        const size_t size = segment_->size();
+        if (offset_ + HEADER_SIZE <= size)
+        {
+            size_t n = read_size(base + offset_);
+            if (n != 0 && n <= size - offset_ - HEADER_SIZE)
+            {
+                m = encoded_message(segment_, base + offset_ + HEADER_SIZE, n);
+                offset_ += HEADER_SIZE + n;
+                return true;
+            }
+        }
+        segment_.reset();
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef journal_hpp
+#define journal_hpp
+
+#include "encoded_message.hpp"
+
+#include <proton/message.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+class mapped_file;
+
+// An append only log of encoded messages in a directory of fixed size,
+// memory mapped segment files named 00000000.jnl, 00000001.jnl and so on.
+// Each segment is the 8 bytes "MENJRNL1" followed by records, a 4 byte big
+// endian size and then the encoded message, and ends at a zero size.
+//
+// An append is a copy into the mapped segment, so it costs no system call.
+// A record's size is written after its bytes, so a reader never sees half a
+// record, and what has been appended survives the process crashing. A
+// background thread msyncs whatever has been appended every sync_interval,
+// so a machine crash loses at most that much.
+//
+// Opening an existing journal carries on after its last whole record.
+// Thread safe. Throws std::runtime_error if a segment cannot be created or
+// mapped.
+class journal
+{
+public:
+    explicit journal(const std::string& dir, size_t segment_size = 64 << 20,
+                     std::chrono::milliseconds sync_interval = std::chrono::milliseconds(100));
+    ~journal();
+
+    journal(const journal&) = delete;
+    journal& operator=(const journal&) = delete;
+
+    void append(const proton::message& m);
+    void append(const char* data, size_t size);
+
+    // msync everything appended so far
+    void sync();
+
+    size_t appended() const { return appended_; }
+
+private:
+    void open_segment(size_t index);
+    void roll(size_t need);
+    void run_syncer();
+
+    const std::string dir_;
+    const size_t segment_size_;
+    const std::chrono::milliseconds sync_interval_;
+
+    // Protected by lock_
+    std::mutex lock_;
+    std::shared_ptr<mapped_file> segment_;
+    size_t index_;                          // of segment_
+    size_t written_;                        // Bytes of segment_ in use
+    size_t synced_;                         // Bytes of segment_ msynced
+    std::vector<std::pair<std::shared_ptr<mapped_file>, size_t> > retired_; // Full, still to msync
+    bool stop_;
+    std::condition_variable wake_;
+
+    std::atomic<size_t> appended_;          // Records
+    std::thread syncer_;
+};
+
+// Reads a journal from the start, one record at a time. Each message refers
+// to the mapped segment it is in, nothing is copied, and keeps the segment
+// mapped for as long as it lives. Not thread safe.
+class journal_reader
+{
+public:
+    explicit journal_reader(const std::string& dir);
+
+    // Returns false at the end of the journal
+    bool next(encoded_message& m);
+
+private:
+    bool open_next();
+
+    const std::string dir_;
+    std::vector<std::string> files_;
+    size_t file_;                           // Next of files_ to open
+    std::shared_ptr<mapped_file> segment_;
+    size_t offset_;
+};
+
+#endif /* journal_hpp */
@@ -0,0 +1,81 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "latency.hpp"
+
+#include <proton/scalar.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+
+const char* const latency_stats::ENQUEUED_AT = "x-menagerie-enqueued-ns";
+const char* const latency_stats::SENT_AT = "x-menagerie-sent-ns";
+
+namespace
+{
+    const char* STAGE_NAMES[STAGE_COUNT] = { "credit-wait", "work-queue", "transit", "buffer", "end-to-end" };
+}
+
+latency_stats& latency_stats::instance()
+{
+    static latency_stats stats;
+    return stats;
+}
+
+latency_stats::latency_stats()
+: enabled_(std::getenv("MENAGERIE_LATENCY") != 0), dump_at_exit_(enabled_)
+{
+}
+
+latency_stats::~latency_stats()
+{
+    if (dump_at_exit_)
+        dump(std::cout);
+}
+
+void latency_stats::reset()
+{
+    for (auto& h : stages_)
+        h.reset();
+}
+
+void latency_stats::dump(std::ostream& o) const
+{
+    for (int s = 0; s < STAGE_COUNT; ++s)
+    {
+        o << "latency " << STAGE_NAMES[s] << ": ";
+        stages_[s].print(o);
+        o << '\n';
+    }
+    o.flush();
+}
+
+int64_t latency_stats::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int64_t latency_stats::stamp(const proton::message& m, const char* name)
+{
+    const proton::message::property_map& properties = m.properties();
+    return properties.exists(name) ? proton::get<int64_t>(properties.get(name)) : 0;
+}
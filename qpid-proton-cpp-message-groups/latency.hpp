@@ -0,0 +1,94 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef latency_hpp
+#define latency_hpp
+
+#include "histogram.hpp"
+
+#include <proton/message.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+
+// Where a message spends its time between sender::send() and
+// receiver::receive()
+enum latency_stage
+{
+    STAGE_CREDIT_WAIT,      // send() waiting for AMQP credit
+    STAGE_WORK_QUEUE,       // Queued for the proton thread
+    STAGE_TRANSIT,          // Written by the sender until read by the receiver, broker included
+    STAGE_BUFFER,           // Buffered in the receiver until returned by receive()
+    STAGE_END_TO_END,       // send() until receive()
+    STAGE_COUNT
+};
+
+// Optional per-message timing, off unless enabled.
+//
+// When enabled the sender stamps each message with the time it was given to
+// send() and the time it was written to the link, as application properties,
+// and the receiver notes when it arrived and when it was returned. Each stage
+// goes into its own histogram of nanoseconds, readable at any time and
+// dumped at exit if asked to.
+//
+// Times are wall clock, so stages measured across hosts are only as good as
+// the clock synchronisation between them.
+class latency_stats
+{
+public:
+    // Application property names
+    static const char* const ENQUEUED_AT;
+    static const char* const SENT_AT;
+
+    // Enabled from the start if the MENAGERIE_LATENCY environment variable is
+    // set, in which case the stages are also dumped at exit.
+    static latency_stats& instance();
+
+    // Thread safe
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    void enable(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+    void dump_at_exit(bool on) { dump_at_exit_ = on; }
+
+    const histogram& stage(latency_stage s) const { return stages_[s]; }
+    void record(latency_stage s, int64_t from, int64_t to)
+    {
+        if (from > 0 && to >= from)
+            stages_[s].record(uint64_t(to - from));
+    }
+    void reset();
+    void dump(std::ostream& o) const;
+
+    // Nanoseconds since the epoch
+    static int64_t now();
+    // A timestamp property of m, 0 if it has none
+    static int64_t stamp(const proton::message& m, const char* name);
+
+    ~latency_stats();
+
+private:
+    latency_stats();
+
+    std::atomic<bool> enabled_;
+    bool dump_at_exit_;
+    histogram stages_[STAGE_COUNT];
+};
+
+#endif /* latency_hpp */
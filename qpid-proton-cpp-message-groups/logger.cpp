@@ -0,0 +1,145 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "logger.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+
+namespace
+{
+    // How long the background thread sleeps when there is nothing to write
+    const std::chrono::milliseconds IDLE(5);
+
+    // Each thread formats into its own buffer, reused from record to record
+    thread_local std::ostringstream format_buffer;
+
+    log_level initial_level()
+    {
+        const char* env = std::getenv("MENAGERIE_LOG");
+        if (env)
+        {
+            const char* names[] = { "trace", "debug", "info", "warn", "error" };
+            for (int i = LOG_LEVEL_TRACE; i <= LOG_LEVEL_ERROR; ++i)
+            {
+                if (std::strcmp(env, names[i]) == 0)
+                    return log_level(i);
+            }
+        }
+        return LOG_LEVEL_INFO;
+    }
+}
+
+logger& logger::instance()
+{
+    static logger l;
+    return l;
+}
+
+logger::logger()
+: level_(initial_level()), head_(nullptr), queued_(0), written_(0), stopping_(false)
+{
+    flusher_ = std::thread([this]() { this->run(); });
+}
+
+logger::~logger()
+{
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        stopping_ = true;
+    }
+    idle_.notify_one();
+    flusher_.join();
+    write_pending();
+}
+
+std::ostream& logger::stream()
+{
+    format_buffer.str(std::string());
+    format_buffer.clear();
+    return format_buffer;
+}
+
+void logger::commit(log_level l)
+{
+    record* r = new record;
+    r->level = l;
+    r->text = format_buffer.str();
+    r->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed));
+    ++queued_;
+}
+
+void logger::flush()
+{
+    size_t target = queued_.load();
+    idle_.notify_one();
+    while (written_.load() < target)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// Background thread
+void logger::run()
+{
+    for (;;)
+    {
+        if (write_pending() > 0)
+            continue;
+        std::unique_lock<std::mutex> l(lock_);
+        if (stopping_)
+            return;
+        idle_.wait_for(l, IDLE);
+    }
+}
+
+// Write out every queued record, oldest first. Returns how many there were.
+size_t logger::write_pending()
+{
+    record* list = head_.exchange(nullptr, std::memory_order_acquire);
+    if (!list)
+        return 0;
+
+    // The list is newest first
+    record* oldest = nullptr;
+    while (list)
+    {
+        record* next = list->next;
+        list->next = oldest;
+        oldest = list;
+        list = next;
+    }
+
+    size_t n = 0;
+    while (oldest)
+    {
+        record* r = oldest;
+        oldest = r->next;
+        (r->level >= LOG_LEVEL_WARN ? std::cerr : std::cout) << r->text << '\n';
+        delete r;
+        ++n;
+    }
+    std::cout.flush();
+    std::cerr.flush();
+    written_ += n;
+    return n;
+}
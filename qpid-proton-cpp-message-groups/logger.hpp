@@ -0,0 +1,126 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef logger_hpp
+#define logger_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Levels, also usable in the preprocessor
+#define MENAGERIE_LOG_TRACE 0
+#define MENAGERIE_LOG_DEBUG 1
+#define MENAGERIE_LOG_INFO  2
+#define MENAGERIE_LOG_WARN  3
+#define MENAGERIE_LOG_ERROR 4
+
+// Logging below this level is compiled out entirely, e.g.
+// -DMENAGERIE_LOG_LEVEL=MENAGERIE_LOG_WARN takes per-message logging off the
+// hot path at no cost at all.
+#ifndef MENAGERIE_LOG_LEVEL
+#define MENAGERIE_LOG_LEVEL MENAGERIE_LOG_DEBUG
+#endif
+
+
+enum log_level
+{
+    LOG_LEVEL_TRACE = MENAGERIE_LOG_TRACE,
+    LOG_LEVEL_DEBUG = MENAGERIE_LOG_DEBUG,
+    LOG_LEVEL_INFO = MENAGERIE_LOG_INFO,
+    LOG_LEVEL_WARN = MENAGERIE_LOG_WARN,
+    LOG_LEVEL_ERROR = MENAGERIE_LOG_ERROR
+};
+
+// Asynchronous logging that never takes a lock on the logging thread.
+//
+// A thread formats into its own buffer, then pushes the finished record onto
+// a lock free list. A background thread takes the whole list in one go and
+// writes it out, warnings and errors to std::cerr and the rest to std::cout.
+// Records from one thread stay in order. Anything still queued is written
+// when the program exits.
+//
+// The runtime level starts at info, or at the MENAGERIE_LOG environment
+// variable (trace, debug, info, warn or error) if it is set.
+class logger
+{
+public:
+    static logger& instance();
+
+    // Thread safe
+    void level(log_level l) { level_.store(l, std::memory_order_relaxed); }
+    log_level level() const { return log_level(level_.load(std::memory_order_relaxed)); }
+    bool enabled(log_level l) const { return l >= level_.load(std::memory_order_relaxed); }
+
+    // The calling thread's format buffer, emptied
+    std::ostream& stream();
+    // Queue what was written to stream() as one record
+    void commit(log_level l);
+
+    // Block until everything logged so far has been written
+    void flush();
+
+    ~logger();
+
+private:
+    struct record
+    {
+        record* next;
+        log_level level;
+        std::string text;
+    };
+
+    logger();
+    logger(const logger&) = delete;
+    logger& operator=(const logger&) = delete;
+
+    void run();
+    size_t write_pending();
+
+    std::atomic<int> level_;
+    std::atomic<record*> head_;            // Newest record first
+    std::atomic<size_t> queued_;           // Records pushed so far
+    std::atomic<size_t> written_;          // Records written so far
+
+    // Only used to put the background thread to sleep, never by loggers
+    std::mutex lock_;
+    std::condition_variable idle_;
+    bool stopping_;
+    std::thread flusher_;
+};
+
+#define MENAGERIE_LOG(lvl, x) \
+    do { \
+        if ((lvl) >= MENAGERIE_LOG_LEVEL && logger::instance().enabled(lvl)) { \
+            logger& logger_ = logger::instance(); \
+            logger_.stream() << x; \
+            logger_.commit(lvl); \
+        } \
+    } while (false)
+
+#define LOG_TRACE(x) MENAGERIE_LOG(LOG_LEVEL_TRACE, x)
+#define LOG_DEBUG(x) MENAGERIE_LOG(LOG_LEVEL_DEBUG, x)
+#define LOG_INFO(x) MENAGERIE_LOG(LOG_LEVEL_INFO, x)
+#define LOG_WARN(x) MENAGERIE_LOG(LOG_LEVEL_WARN, x)
+#define LOG_ERROR(x) MENAGERIE_LOG(LOG_LEVEL_ERROR, x)
+
+#endif /* logger_hpp */
@@ -0,0 +1,83 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace
+{
+    std::runtime_error failure(const std::string& what, const std::string& path)
+    {
+        return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+    }
+}
+
+mapped_file::mapped_file(const std::string& path, bool writable, size_t size)
+: base_(0), size_(0)
+{
+    int fd = writable ? ::open(path.c_str(), O_RDWR | O_CREAT, 0644) : ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw failure("cannot open", path);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw failure("cannot stat", path);
+    }
+    size_ = size_t(st.st_size);
+    if (writable && size_ < size)
+    {
+        if (::ftruncate(fd, off_t(size)) != 0)
+        {
+            ::close(fd);
+            throw failure("cannot size", path);
+        }
+        size_ = size;
+    }
+
+    void* p = size_ ? ::mmap(0, size_, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0) : 0;
+    ::close(fd);
+    if (p == MAP_FAILED)
+        throw failure("cannot map", path);
+    base_ = static_cast<char*>(p);
+}
+
+mapped_file::~mapped_file()
+{
+    if (base_)
+        ::munmap(base_, size_);
+}
+
+void mapped_file::sync(size_t from, size_t to)
+{
+    static const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+    from -= from % page;
+    if (to > from)
+        ::msync(base_ + from, to - from, MS_SYNC);
+}
@@ -0,0 +1,51 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef mapped_file_hpp
+#define mapped_file_hpp
+
+#include <cstddef>
+#include <string>
+
+
+// A file mapped into memory, shared with the file, unmapped when destroyed.
+// Throws std::runtime_error if the file cannot be opened, sized or mapped.
+class mapped_file
+{
+public:
+    // writable creates the file if need be and grows it to size, otherwise
+    // the whole existing file is mapped
+    mapped_file(const std::string& path, bool writable, size_t size = 0);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    char* data() const { return base_; }
+    size_t size() const { return size_; }
+
+    // msync [from, to), from is rounded down to a page
+    void sync(size_t from, size_t to);
+
+private:
+    char* base_;
+    size_t size_;
+};
+
+#endif /* mapped_file_hpp */
@@ -20,9 +20,12 @@
  */
 
 #include "message-groups.hpp"
+#include "message_pool.hpp"
 #include "receiver.hpp"
 #include "sender.hpp"
-#include "out_lock.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "journal.hpp"
 
 #include <proton/container.hpp>
 #include <proton/message.hpp>
@@ -33,52 +36,61 @@
 #include <string>
 #include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <memory>
 #include <vector>
-#include <queue>
 #include <algorithm>
 #include <assert.h>
 
 
 // ==== Example code using the sender and receiver
-void generate_messages(std::queue<proton::message>& messages, int n, std::string& group_id)
+void generate_messages(message_pool& pool, std::vector<pooled_message>& messages, int n, const std::string& group_id)
 {
+    // Pooled messages are refilled in place and handed to the sender without
+    // a copy. Every field that differs between messages is set on each one.
+    std::ostringstream ss;
+    ss << std::this_thread::get_id() << "-";
+    const std::string prefix = ss.str();
+    std::string body;
+    
     for (int i = 0; i < n; ++i)
     {
-        std::ostringstream ssid;
-        std::ostringstream ss;
-        ss << std::this_thread::get_id() << "-" << i;
-        proton::message m = proton::message(ss.str());
-        
-        m.group_id(group_id);
-        if ((messages.size() == n-1) && (!group_id.empty()))
-        {
-            m.group_sequence(-1);
-        }
-        messages.push(m);
+        pooled_message m = pool.acquire();
+        body.assign(prefix);
+        body += std::to_string(i);
+        m->body(body);
+        m->group_id(group_id);
+        m->group_sequence(i == n - 1 && !group_id.empty() ? -1 : 0);
+        messages.push_back(std::move(m));
     }
 }
 
-// Send n messages
-void send_thread(sender& s, int n, bool use_message_grouping = false)
+// Send n messages. pool must outlive the sender's work items, which hold its
+// messages until the proton thread has sent them.
+void send_thread(sender& s, message_pool& pool, int n, bool use_message_grouping = false)
 {
     assert(n >= 4);
     
-    std::queue<proton::message> messages;
+    std::vector<pooled_message> messages;
     std::string group_id = "";
     auto id = std::this_thread::get_id();
 
     if (use_message_grouping)
         group_id = "groupA";
     
-    generate_messages(messages, 8, group_id);
-    s.send(messages);
-    OUT(std::cout << id << " sent " << 8 << std::endl);
+    generate_messages(pool, messages, 8, group_id);
+    for (auto& m : messages)
+        s.send(m);
+    messages.clear();
+    LOG_INFO(id << " sent " << 8);
     
     if (use_message_grouping)
         group_id = "groupB";
-    generate_messages(messages, 8, group_id);
-    s.send(messages);
-    OUT(std::cout << id << " sent " << 8 << std::endl);
+    generate_messages(pool, messages, 8, group_id);
+    for (auto& m : messages)
+        s.send(m);
+    messages.clear();
+    LOG_INFO(id << " sent " << 8);
 }
 
 // Receive messages till atomic remaining count is 0.
@@ -100,10 +112,10 @@ void receive_thread(receiver& r, std::atomic_int& remaining, int thread_index)
         {
             std::this_thread::sleep_for(std::chrono::milliseconds(1000));
         }
-        OUT(std::cout << "receiver" << thread_index << " received \"" << m.body() << '"' << " group-id " << m.group_id() << " group-sequence " << m.group_sequence() << " reply-to-group-id " << m.reply_to_group_id() << " remaining " << remaining << std::endl);
+        LOG_INFO("receiver" << thread_index << " received \"" << m.body() << '"' << " group-id " << m.group_id() << " group-sequence " << m.group_sequence() << " reply-to-group-id " << m.reply_to_group_id() << " remaining " << remaining);
     }
     while (--remaining > 0);
-    OUT(std::cout << "receiver" << thread_index << " received " << n << " messages" << std::endl);
+    LOG_INFO("receiver" << thread_index << " received " << n << " messages, window " << r.controller().window() << " credit " << r.credit() << " buffered " << r.buffered());
 }
 
 void receive_thread(receiver& r, int thread_index, int seconds_timeout)
@@ -122,7 +134,7 @@ void receive_thread(receiver& r, int thread_index, int seconds_timeout)
         if (message_received)
         {
             ++n;
-            OUT(std::cout << "receiver" << thread_index << " received \"" << m.body() << '"' << " group-id " << m.group_id() << " group-sequence " << m.group_sequence() << " reply-to-group-id " << m.reply_to_group_id() << std::endl);
+            LOG_INFO("receiver" << thread_index << " received \"" << m.body() << '"' << " group-id " << m.group_id() << " group-sequence " << m.group_sequence() << " reply-to-group-id " << m.reply_to_group_id());
         }
         else
         {
@@ -130,18 +142,19 @@ void receive_thread(receiver& r, int thread_index, int seconds_timeout)
         }
     }
     while (true);
-    OUT(std::cout << "receiver" << thread_index << " received " << n << " messages" << std::endl);
+    LOG_INFO("receiver" << thread_index << " received " << n << " messages, window " << r.controller().window() << " credit " << r.credit() << " buffered " << r.buffered());
 }
 
 
 int main(int argc, const char **argv) {
     try {
-        if (argc != 4) {
+        if (argc != 4 && argc != 5) {
             std::cerr <<
             "Usage: " << argv[0] <<
             "CONNECTION-URL: connection address, e.g.'amqp://127.0.0.1'\n"
             "AMQP-ADDRESS: AMQP node address, e.g. 'examples'\n"
-            "GROUPS: 1 to use message groups, 0 to not use message groups\n";
+            "GROUPS: 1 to use message groups, 0 to not use message groups\n"
+            "IO-THREADS: threads running the container, default 1\n";
             return 1;
         }
         
@@ -149,6 +162,7 @@ int main(int argc, const char **argv) {
         const char *url = argv[1];
         const char *address = argv[2];
         const bool use_message_groups = atoi(argv[3]) > 0;
+        const int io_threads = argc > 4 ? std::max(1, atoi(argv[4])) : 1;
         std::vector<std::thread> threads;
         
         // Total messages to be received, multiple receiver threads will decrement this.
@@ -160,22 +174,38 @@ int main(int argc, const char **argv) {
             remaining1.store(8);
         }
         
-        // Run the proton container
+        // Export metrics every second to the file or "unix:" socket named by
+        // MENAGERIE_METRICS, if set
+        std::unique_ptr<metrics_exporter> exporter;
+        if (const char* target = std::getenv("MENAGERIE_METRICS"))
+            exporter.reset(new metrics_exporter(target));
+        
+        // Journal every message received to the directory named by
+        // MENAGERIE_JOURNAL, if set
+        std::unique_ptr<journal> received_journal;
+        if (const char* dir = std::getenv("MENAGERIE_JOURNAL"))
+            received_journal.reset(new journal(dir));
+        
+        // Messages for the sending thread, made before and so destroyed after
+        // the container that sends them
+        message_pool pool(proton::message(), 8);
+        
+        // Run the proton container, with io_threads handling events
         proton::container container;
-        auto container_thread = std::thread([&]() { container.run(); });
+        auto container_thread = std::thread([&]() { container.run(io_threads); });
         
         sender send(container, url, address);
-        receiver recv0(container, url, address);
-        receiver recv1(container, url, address);
+        receiver recv0(container, url, address, credit_limits(), ack_policy(), received_journal.get());
+        receiver recv1(container, url, address, credit_limits(), ack_policy(), received_journal.get());
 
-        OUT(std::cout << "Starting sending thread for 8 messages per group\n");
-        OUT(std::cout << "Each thread individually waits 20 seconds maximum after the last message received if any\n");
-        threads.push_back(std::thread([&]() { send_thread(send, message_count, use_message_groups); }));
+        LOG_INFO("Starting sending thread for 8 messages per group");
+        LOG_INFO("Each thread individually waits 20 seconds maximum after the last message received if any");
+        threads.push_back(std::thread([&]() { send_thread(send, pool, message_count, use_message_groups); }));
         
-        OUT(std::cout << "Sleeping for 2 seconds\n");
+        LOG_INFO("Sleeping for 2 seconds");
         std::this_thread::sleep_for(std::chrono::seconds(2));
         
-        OUT(std::cout << "Starting receiver threads 0, 1\n");
+        LOG_INFO("Starting receiver threads 0, 1");
         if (use_message_groups)
         {
             threads.push_back(std::thread([&]() { receive_thread(recv0, remaining0, 0); }));
@@ -188,7 +218,7 @@ int main(int argc, const char **argv) {
         }
 
         // Wait for threads to finish
-        OUT(std::cout << "Waiting for threads to finish\n");
+        LOG_INFO("Waiting for threads to finish");
         for (auto& t : threads)
             t.join();
         send.close();
@@ -0,0 +1,177 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Allocations per message on the producer side, from building a message to
+// the work item sender::send() hands the proton thread. With glibc every
+// malloc(), calloc() and realloc() is counted, so proton's pn_message_t and
+// pn_data_t allocations are too, as well as operator new which goes through
+// malloc(). Elsewhere only operator new is counted and the figures are a
+// lower bound. Three ways of producing a grouped message:
+//  - fresh: a new message per send, built as generate_messages() used to,
+//    copied into the work item
+//  - template: a copy of a message with the group already set, copied into
+//    the work item
+//  - pool: a message_pool message refilled in place, the work item holds a
+//    pooled_message handle
+// No broker is needed, the work item is run and destroyed as the proton
+// thread would.
+
+#include "message_pool.hpp"
+
+#include <proton/message.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+
+
+namespace
+{
+    std::atomic<size_t> allocations(0);
+}
+
+#ifdef __GLIBC__
+// Stand in for glibc's allocator, which proton's C code calls as well
+extern "C"
+{
+    void* __libc_malloc(size_t n);
+    void* __libc_calloc(size_t count, size_t n);
+    void* __libc_realloc(void* p, size_t n);
+
+    void* malloc(size_t n) noexcept
+    {
+        ++allocations;
+        return __libc_malloc(n);
+    }
+
+    void* calloc(size_t count, size_t n) noexcept
+    {
+        ++allocations;
+        return __libc_calloc(count, n);
+    }
+
+    void* realloc(void* p, size_t n) noexcept
+    {
+        ++allocations;
+        return __libc_realloc(p, n);
+    }
+}
+#else
+void* operator new(std::size_t n)
+{
+    ++allocations;
+    void* p = std::malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+#endif
+
+namespace
+{
+    const std::string GROUP = "groupA";
+
+    // Stands in for the proton thread running the work item
+    size_t sent_bytes = 0;
+    void do_send(const proton::message& m)
+    {
+        sent_bytes += m.group_id().size();
+    }
+
+    void fresh(int i)
+    {
+        std::ostringstream ssid;
+        std::ostringstream ss;
+        ss << std::this_thread::get_id() << "-" << i;
+        proton::message m = proton::message(ss.str());
+        m.group_id(GROUP);
+        std::function<void()> work([=]() { do_send(m); });
+        work();
+    }
+
+    void from_template(const proton::message& prototype, std::string& body, int i)
+    {
+        proton::message m(prototype);
+        body.assign("worker-");
+        body += std::to_string(i);
+        m.body(body);
+        std::function<void()> work([=]() { do_send(m); });
+        work();
+    }
+
+    void from_pool(message_pool& pool, std::string& body, int i)
+    {
+        pooled_message m = pool.acquire();
+        body.assign("worker-");
+        body += std::to_string(i);
+        m->body(body);
+        std::function<void()> work([=]() { do_send(*m); });
+        work();
+    }
+
+    // Runs f n times, printing allocations per message and time per message
+    template <class F>
+    void measure(const char* name, int n, F f)
+    {
+        size_t before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i)
+            f(i);
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        size_t count = allocations.load() - before;
+        std::cout << name << "\t" << double(count) / n << "\t\t" << elapsed.count() / n << std::endl;
+    }
+}
+
+int main(int argc, const char **argv) {
+    if (argc > 2) {
+        std::cerr <<
+        "Usage: " << argv[0] << " [MESSAGE-COUNT]\n"
+        "MESSAGE-COUNT: messages per run, default 1000000\n";
+        return 1;
+    }
+
+    const int message_count = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    proton::message prototype;
+    prototype.group_id(GROUP);
+    message_pool pool(prototype, 64);
+    std::string body;
+
+    std::cout << "path\t\tallocs/msg\tns/msg\n";
+    measure("fresh\t", message_count, [](int i) { fresh(i); });
+    measure("template", message_count, [&](int i) { from_template(prototype, body, i); });
+    measure("pool\t", message_count, [&](int i) { from_pool(pool, body, i); });
+    std::cout << "pool made " << pool.created() << " messages" << std::endl;
+
+    return sent_bytes > 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "message_batch.hpp"
+
+#include <proton/value.hpp>
+
+#include <stdexcept>
+
+
+const char* const message_batch::BATCH_CONTENT_TYPE = "application/x-menagerie-batch";
+
+message_batch::message_batch(const std::string& group_id)
+: group_id_(group_id), count_(0)
+{
+}
+
+void message_batch::add(const proton::message& m)
+{
+    // Encode into a buffer each thread keeps
+    static thread_local std::vector<char> bytes;
+    m.encode(bytes);
+    const size_t size = bytes.size();
+    const uint8_t header[4] = { uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size) };
+    body_.insert(body_.end(), header, header + sizeof(header));
+    body_.insert(body_.end(), bytes.begin(), bytes.end());
+    ++count_;
+}
+
+proton::message message_batch::take()
+{
+    proton::message envelope;
+    if (!group_id_.empty())
+        envelope.group_id(group_id_);
+    envelope.content_type(BATCH_CONTENT_TYPE);
+    envelope.body(body_);
+    body_.clear();
+    count_ = 0;
+    return envelope;
+}
+
+bool message_batch::is_batch(const proton::message& m)
+{
+    return std::string(m.content_type()) == BATCH_CONTENT_TYPE;
+}
+
+void message_batch::unbatch(const proton::message& envelope, std::vector<proton::message>& out)
+{
+    const proton::binary body = proton::get<proton::binary>(envelope.body());
+    size_t offset = 0;
+    std::vector<char> bytes;
+    while (offset < body.size())
+    {
+        if (body.size() - offset < 4)
+            throw std::runtime_error("truncated message batch");
+        const uint8_t* h = body.data() + offset;
+        const size_t size = size_t(h[0]) << 24 | size_t(h[1]) << 16 | size_t(h[2]) << 8 | h[3];
+        offset += 4;
+        if (body.size() - offset < size)
+            throw std::runtime_error("truncated message batch");
+        bytes.assign(body.begin() + offset, body.begin() + offset + size);
+        out.push_back(proton::message());
+        out.back().decode(bytes);
+        offset += size;
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef message_batch_hpp
+#define message_batch_hpp
+
+#include <proton/binary.hpp>
+#include <proton/message.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// Packs many small messages of one group into a single AMQP message, so they
+// share one transfer, one disposition and one credit. The envelope has the
+// group's group_id, content_type BATCH_CONTENT_TYPE and a binary body of
+// each message as its size, a 4 byte big endian integer, and then its
+// encoded bytes. receiver unpacks envelopes as they arrive. Not thread safe.
+class message_batch
+{
+public:
+    static const char* const BATCH_CONTENT_TYPE;
+
+    explicit message_batch(const std::string& group_id = std::string());
+
+    // m should have the batch's group_id
+    void add(const proton::message& m);
+
+    const std::string& group_id() const { return group_id_; }
+    size_t size() const { return count_; }
+    size_t bytes() const { return body_.size(); }
+    bool empty() const { return count_ == 0; }
+
+    // The envelope of everything added so far, after which the batch is empty
+    proton::message take();
+
+    static bool is_batch(const proton::message& m);
+    // Appends the messages in envelope to out, in the order they were added.
+    // Throws std::runtime_error if the envelope is malformed.
+    static void unbatch(const proton::message& envelope, std::vector<proton::message>& out);
+
+private:
+    std::string group_id_;
+    proton::binary body_;
+    size_t count_;
+};
+
+#endif /* message_batch_hpp */
@@ -0,0 +1,62 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "message_pool.hpp"
+
+
+message_pool::message_pool(const proton::message& prototype, size_t capacity)
+: prototype_(prototype), free_(capacity), created_(0)
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        pool_node* n = new pool_node{ prototype_, {0}, this };
+        ++created_;
+        if (!free_.try_push(std::move(n)))
+        {
+            delete n;
+            break;
+        }
+    }
+}
+
+message_pool::~message_pool()
+{
+    pool_node* n = 0;
+    while (free_.try_pop(n))
+        delete n;
+}
+
+pooled_message message_pool::acquire()
+{
+    pool_node* n = 0;
+    if (!free_.try_pop(n))
+    {
+        n = new pool_node{ prototype_, {0}, this };
+        ++created_;
+    }
+    n->refs.store(1, std::memory_order_relaxed);
+    return pooled_message(n);
+}
+
+// The last handle to n has gone
+void message_pool::recycle(pool_node* n)
+{
+    if (!free_.try_push(std::move(n)))
+        delete n;
+}
@@ -0,0 +1,118 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef message_pool_hpp
+#define message_pool_hpp
+
+#include "ring_buffer.hpp"
+
+#include <proton/message.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+class message_pool;
+
+// A pooled message and its handle count
+struct pool_node
+{
+    proton::message message;
+    std::atomic<int> refs;
+    message_pool* pool;
+};
+
+// A message borrowed from a message_pool, given back when the last handle to
+// it goes. Copying a handle only counts, copies share the one message, so a
+// handle is cheap to capture in a work item. Thread safe as a shared_ptr is.
+class pooled_message
+{
+    pool_node* node_;
+
+    friend class message_pool;
+    explicit pooled_message(pool_node* n) : node_(n) {}
+    void release();
+
+public:
+    pooled_message() : node_(0) {}
+    pooled_message(const pooled_message& o) : node_(o.node_)
+    {
+        if (node_)
+            node_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    pooled_message(pooled_message&& o) : node_(o.node_) { o.node_ = 0; }
+    pooled_message& operator=(pooled_message o) { std::swap(node_, o.node_); return *this; }
+    ~pooled_message() { release(); }
+
+    proton::message& operator*() const { return node_->message; }
+    proton::message* operator->() const { return &node_->message; }
+    explicit operator bool() const { return node_ != 0; }
+
+    // Put the message back as the pool's prototype has it
+    void reset();
+};
+
+// Reusable messages for producers that send the same shape of message over
+// and over. Every message starts as a copy of prototype, with its group_id,
+// properties and so on already set, and only what differs from message to
+// message needs filling in. Once the last handle goes the message goes back
+// on a lock free free list as it is, with no reset, so fields set on one
+// message should be set on every message, or reset() called.
+//
+// capacity messages are made up front. If they are all out acquire() makes
+// more, which the pool keeps up to its capacity. The pool must outlive every
+// handle taken from it.
+class message_pool
+{
+public:
+    message_pool(const proton::message& prototype, size_t capacity);
+    ~message_pool();
+
+    // Thread safe
+    pooled_message acquire();
+
+    const proton::message& prototype() const { return prototype_; }
+    // Messages made so far, steady once the pool is big enough
+    size_t created() const { return created_.load(std::memory_order_relaxed); }
+
+private:
+    message_pool(const message_pool&) = delete;
+    message_pool& operator=(const message_pool&) = delete;
+
+    friend class pooled_message;
+    void recycle(pool_node* n);
+
+    const proton::message prototype_;
+    ring_buffer<pool_node*> free_;
+    std::atomic<size_t> created_;
+};
+
+inline void pooled_message::release()
+{
+    if (node_ && node_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        node_->pool->recycle(node_);
+    node_ = 0;
+}
+
+inline void pooled_message::reset()
+{
+    node_->message = node_->pool->prototype();
+}
+
+#endif /* message_pool_hpp */
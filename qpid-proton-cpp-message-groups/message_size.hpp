@@ -0,0 +1,57 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef message_size_hpp
+#define message_size_hpp
+
+#include <proton/message.hpp>
+#include <proton/types.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// Rough size of a decoded message without its body
+const size_t HEADER_OVERHEAD = 256;
+
+// Approximate memory held by a decoded message, without encoding the usual
+// bodies. Header only, so the el6 send_handler can share it.
+inline size_t message_size(const proton::message& m)
+{
+    const proton::value& body = m.body();
+    switch (body.type())
+    {
+        case proton::STRING:
+        case proton::SYMBOL:
+            return HEADER_OVERHEAD + proton::get<std::string>(body).size();
+        case proton::BINARY:
+            return HEADER_OVERHEAD + proton::get<proton::binary>(body).size();
+        default:
+        {
+            // Structured bodies are rare here, fall back to their encoded size
+            std::vector<char> encoded;
+            m.encode(encoded);
+            return encoded.size();
+        }
+    }
+}
+
+#endif /* message_size_hpp */
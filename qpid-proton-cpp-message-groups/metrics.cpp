@@ -0,0 +1,203 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "metrics.hpp"
+#include "logger.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+
+// == counter
+
+counter::counter()
+{
+    for (auto& s : stripes_)
+        s.value.store(0, std::memory_order_relaxed);
+}
+
+size_t counter::this_stripe()
+{
+    // Threads take stripes in turn as they first count anything
+    static std::atomic<size_t> next(0);
+    thread_local size_t stripe = next++ % STRIPES;
+    return stripe;
+}
+
+uint64_t counter::value() const
+{
+    uint64_t total = 0;
+    for (auto& s : stripes_)
+        total += s.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+// == metrics
+
+metrics& metrics::instance()
+{
+    static metrics m;
+    return m;
+}
+
+counter& metrics::get_counter(const std::string& name)
+{
+    std::lock_guard<std::mutex> l(lock_);
+    std::unique_ptr<counter>& c = counters_[name];
+    if (!c)
+        c.reset(new counter);
+    return *c;
+}
+
+gauge& metrics::get_gauge(const std::string& name)
+{
+    std::lock_guard<std::mutex> l(lock_);
+    std::unique_ptr<gauge>& g = gauges_[name];
+    if (!g)
+        g.reset(new gauge);
+    return *g;
+}
+
+histogram& metrics::get_histogram(const std::string& name)
+{
+    std::lock_guard<std::mutex> l(lock_);
+    std::unique_ptr<histogram>& h = histograms_[name];
+    if (!h)
+        h.reset(new histogram);
+    return *h;
+}
+
+void metrics::snapshot(std::ostream& o)
+{
+    std::lock_guard<std::mutex> l(lock_);
+    for (auto& c : counters_)
+        o << c.first << ' ' << c.second->value() << '\n';
+    for (auto& g : gauges_)
+        o << g.first << ' ' << g.second->value() << '\n';
+    for (auto& h : histograms_)
+    {
+        o << h.first << ' ';
+        h.second->print(o);
+        o << '\n';
+    }
+}
+
+// == metrics_exporter
+
+namespace
+{
+    const char UNIX_PREFIX[] = "unix:";
+}
+
+metrics_exporter::metrics_exporter(const std::string& target, std::chrono::milliseconds interval)
+: target_(target), interval_(interval), stopping_(false)
+{
+    thread_ = std::thread([this]() { this->run(); });
+}
+
+metrics_exporter::~metrics_exporter()
+{
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        stopping_ = true;
+    }
+    stop_.notify_one();
+    thread_.join();
+}
+
+void metrics_exporter::run()
+{
+    std::unique_lock<std::mutex> l(lock_);
+    while (!stop_.wait_for(l, interval_, [this]() { return stopping_; }))
+    {
+        l.unlock();
+        export_now();
+        l.lock();
+    }
+}
+
+void metrics_exporter::export_now()
+{
+    std::ostringstream text;
+    text << "# " << std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() << '\n';
+    metrics::instance().snapshot(text);
+
+    if (target_.compare(0, sizeof(UNIX_PREFIX) - 1, UNIX_PREFIX) == 0)
+        write_socket(text.str());
+    else
+        write_file(text.str());
+}
+
+// Write a new file and rename it over the old one, so readers never see half
+// a snapshot
+void metrics_exporter::write_file(const std::string& text)
+{
+    std::string tmp = target_ + ".tmp";
+    {
+        std::ofstream f(tmp.c_str(), std::ios::trunc);
+        f << text;
+        if (!f)
+        {
+            LOG_WARN("metrics_exporter: cannot write " << tmp);
+            return;
+        }
+    }
+    if (std::rename(tmp.c_str(), target_.c_str()) != 0)
+        LOG_WARN("metrics_exporter: cannot rename " << tmp << " to " << target_ << ": " << std::strerror(errno));
+}
+
+void metrics_exporter::write_socket(const std::string& text)
+{
+    std::string path = target_.substr(sizeof(UNIX_PREFIX) - 1);
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        LOG_WARN("metrics_exporter: socket path too long: " << path);
+        return;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+    {
+        const char* p = text.data();
+        size_t left = text.size();
+        while (left > 0)
+        {
+            ssize_t n = ::send(fd, p, left, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            p += n;
+            left -= size_t(n);
+        }
+    }
+    ::close(fd);
+}
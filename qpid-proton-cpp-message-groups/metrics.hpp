@@ -0,0 +1,140 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef metrics_hpp
+#define metrics_hpp
+
+#include "histogram.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+
+// A count that only goes up. Each thread adds to one of several stripes, so
+// threads counting at once rarely touch the same cache line.
+class counter
+{
+    static const size_t STRIPES = 16;
+
+    struct stripe
+    {
+        std::atomic<uint64_t> value;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    stripe stripes_[STRIPES];
+
+    static size_t this_stripe();
+
+public:
+    counter();
+    counter(const counter&) = delete;
+    counter& operator=(const counter&) = delete;
+
+    // Thread safe, a relaxed atomic add
+    void add(uint64_t n = 1) { stripes_[this_stripe()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+};
+
+// A level that goes up and down, like a queue depth
+class gauge
+{
+    std::atomic<int64_t> value_;
+
+public:
+    gauge() : value_(0) {}
+    gauge(const gauge&) = delete;
+    gauge& operator=(const gauge&) = delete;
+
+    // Thread safe
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+};
+
+// Process wide named metrics.
+//
+// Looking a metric up takes a lock, so code on a hot path looks its metrics
+// up once and keeps the reference, which stays valid for the life of the
+// process. Every sender shares the "sender." metrics and every receiver the
+// "receiver." metrics.
+class metrics
+{
+public:
+    static metrics& instance();
+
+    // Thread safe, created on first use
+    counter& get_counter(const std::string& name);
+    gauge& get_gauge(const std::string& name);
+    histogram& get_histogram(const std::string& name);
+
+    // Thread safe, one "name value" line per counter and gauge, and one
+    // histogram summary line per histogram
+    void snapshot(std::ostream& o);
+
+private:
+    metrics() {}
+    metrics(const metrics&) = delete;
+    metrics& operator=(const metrics&) = delete;
+
+    std::mutex lock_;
+    std::map<std::string, std::unique_ptr<counter> > counters_;
+    std::map<std::string, std::unique_ptr<gauge> > gauges_;
+    std::map<std::string, std::unique_ptr<histogram> > histograms_;
+};
+
+// Writes a metrics snapshot every interval from a background thread.
+//
+// target is either a file, which is replaced with each snapshot, or
+// "unix:PATH" to write each snapshot to a listening unix stream socket. A
+// socket that is not listening is simply tried again next time.
+class metrics_exporter
+{
+public:
+    metrics_exporter(const std::string& target, std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    ~metrics_exporter();
+
+    // Write a snapshot now, from the calling thread
+    void export_now();
+
+private:
+    metrics_exporter(const metrics_exporter&) = delete;
+    metrics_exporter& operator=(const metrics_exporter&) = delete;
+
+    void run();
+    void write_file(const std::string& text);
+    void write_socket(const std::string& text);
+
+    std::string target_;
+    std::chrono::milliseconds interval_;
+    std::mutex lock_;
+    std::condition_variable stop_;
+    bool stopping_;
+    std::thread thread_;
+};
+
+#endif /* metrics_hpp */
@@ -20,13 +20,20 @@
  */
 
 #include "receiver.hpp"
-#include "out_lock.hpp"
+#include "compression.hpp"
+#include "journal.hpp"
+#include "latency.hpp"
+#include "logger.hpp"
+#include "message_batch.hpp"
+#include "metrics.hpp"
 
 #include <proton/connection.hpp>
 #include <proton/connection_options.hpp>
+#include <proton/duration.hpp>
 #include <proton/receiver_options.hpp>
 #include <proton/work_queue.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <sstream>
@@ -34,50 +41,294 @@
 #include <chrono>
 
 
-receiver::receiver(proton::container& cont, const std::string& url, const std::string& address)
-: work_queue_()
+namespace
+{
+    // A body may inflate to no more than the process memory ceiling, if one
+    // is set
+    size_t inflate_limit()
+    {
+        size_t ceiling = memory_budget::process().ceiling();
+        return ceiling ? std::min(ceiling, MAX_INFLATED_SIZE) : MAX_INFLATED_SIZE;
+    }
+}
+
+
+receiver::receiver(proton::container& cont, const std::string& url, const std::string& address, const credit_limits& limits, const ack_policy& acks,
+                   journal* j)
+: controller_(limits), reserved_(0), next_id_(0), journal_(j), work_queue_(), pending_count_(0), buffer_(limits.max_messages), granted_(0), received_(0), consumed_(0), credit_pending_(false), overflowed_(0), buffered_bytes_(0),
+  acks_(acks), ack_queue_(acks.manual ? std::max(2 * acks.batch, limits.max_messages) : 2), acks_waiting_(0), flush_posted_(false),
+  received_total_(metrics::instance().get_counter("receiver.received")),
+  consumed_total_(metrics::instance().get_counter("receiver.consumed")),
+  posts_(metrics::instance().get_counter("receiver.work_queue_posts")),
+  flows_(metrics::instance().get_counter("receiver.add_credit_calls")),
+  credit_total_(metrics::instance().get_counter("receiver.credit_granted")),
+  buffered_total_(metrics::instance().get_gauge("receiver.buffered")),
+  buffered_bytes_total_(metrics::instance().get_gauge("receiver.buffered_bytes")),
+  blocked_(metrics::instance().get_gauge("receiver.blocked")),
+  wait_(metrics::instance().get_histogram("receiver.wait_ns")),
+  acks_total_(metrics::instance().get_counter("receiver.acks")),
+  ack_flushes_(metrics::instance().get_counter("receiver.ack_flushes"))
 {
     // NOTE:credit_window(0) disables automatic flow control.
     // We will use flow control to match AMQP credit to buffer capacity.
-    cont.open_receiver(url+"/"+address, proton::receiver_options::receiver_options().credit_window(0),
-                       proton::connection_options::connection_options().handler(*this));
+    // Manual acks leave accepting to ack().
+    cont.open_receiver(url+"/"+address, proton::receiver_options().credit_window(0).auto_accept(!acks.manual),
+                       proton::connection_options().handler(*this));
+}
+
+// Give back to the memory_budget whatever is still held
+receiver::~receiver() {
+    memory_budget::process().release(buffered_bytes_.load() + reserved_);
+    buffered_bytes_total_.add(-int64_t(buffered_bytes_.load()));
 }
 
 // Thread safe receive
 bool receiver::receive(proton::message& m, unsigned int seconds_timeout) {
-    std::unique_lock<std::mutex> l(lock_);
+    entry e;
+    bool message_received = wait_for_message(e, seconds_timeout);
     
-    bool message_received = false;
-    std::chrono::high_resolution_clock hrc;
-    auto tp_now = hrc.now();
-    auto tp_end = tp_now + std::chrono::seconds(30);
+    if (message_received)
+        consumed(take(e, m));
+
+    return message_received;
+}
+
+// Thread safe receive
+bool receiver::receive(proton::message& m, delivery_id& id, unsigned int seconds_timeout) {
+    entry e;
+    bool message_received = wait_for_message(e, seconds_timeout);
     
-    // Wait for buffered messages
-    while (!work_queue_ || buffer_.empty())
+    if (message_received)
+        consumed(take(e, m, &id));
+
+    return message_received;
+}
+
+// Thread safe
+size_t receiver::receive_batch(std::vector<proton::message>& out, size_t max, unsigned int seconds_timeout) {
+    return take_batch(out, 0, max, seconds_timeout);
+}
+
+// Thread safe
+size_t receiver::receive_batch(std::vector<proton::message>& out, std::vector<delivery_id>& ids, size_t max,
+                               unsigned int seconds_timeout) {
+    return take_batch(out, &ids, max, seconds_timeout);
+}
+
+size_t receiver::take_batch(std::vector<proton::message>& out, std::vector<delivery_id>* ids, size_t max,
+                            unsigned int seconds_timeout) {
+    size_t n = 0;
+    
+    if (max > 0)
     {
-        if (0 == seconds_timeout)
+        entry e;
+        if (wait_for_message(e, seconds_timeout))
         {
-            can_receive_.wait(l);
+            size_t transfers = 0;
+            do
+            {
+                out.push_back(proton::message());
+                delivery_id id = 0;
+                transfers += take(e, out.back(), ids ? &id : 0);
+                if (ids)
+                    ids->push_back(id);
+                ++n;
+            }
+            while (n < max && buffer_.try_pop(e));
+            consumed(transfers);
         }
-        else
+    }
+    
+    return n;
+}
+
+// Thread safe. Never takes lock_: the id goes onto ack_queue_, and the
+// proton thread is asked to flush once a batch is waiting, or the interval
+// after the first ack of a batch.
+void receiver::ack(delivery_id id) {
+    if (id == 0)
+        return;
+    acks_total_.add();
+    
+    if (!ack_queue_.try_push(std::move(id)))
+    {
+        // The proton thread has fallen far behind, accept this one on its own
+        work_queue_->add([=]() { this->accept(id); });
+        return;
+    }
+    
+    int64_t waiting = acks_waiting_.fetch_add(1) + 1;
+    if (waiting == 1)
+        work_queue_->schedule(proton::duration(acks_.interval.count()), [this]() { this->flush_acks(); });
+    if (waiting >= int64_t(acks_.batch) && !flush_posted_.exchange(true))
+        work_queue_->add([this]() { this->flush_acks(); });
+}
+
+// Thread safe
+void receiver::async_receive(receive_handler handler, executor exec) {
+    pending_receive p = { std::move(handler), std::move(exec) };
+    entry e;
+    
+    // Only take a message directly when no earlier call is waiting for one,
+    // otherwise this call would complete before them.
+    if (pending_count_.load() == 0 && buffer_.try_pop(e))
+    {
+        proton::message m;
+        consumed(take(e, m));
+        complete(p, m);
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        pending_.push_back(std::move(p));
+        ++pending_count_;
+    }
+    // A message may have been buffered after try_pop() but before the proton
+    // thread could see us in pending_, so look again.
+    complete_pending();
+}
+
+// Thread safe
+std::future<proton::message> receiver::async_receive() {
+    auto promise = std::make_shared<std::promise<proton::message> >();
+    std::future<proton::message> f = promise->get_future();
+    async_receive([promise](proton::message& m) { promise->set_value(std::move(m)); });
+    return f;
+}
+
+// Hand buffered messages to pending async_receive() calls, in order
+void receiver::complete_pending() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pending_count_.load(std::memory_order_relaxed) == 0)
+        return;
+    
+    std::vector<std::pair<pending_receive, proton::message> > ready;
+    size_t transfers = 0;
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        entry e;
+        while (!pending_.empty() && buffer_.try_pop(e))
         {
-            can_receive_.wait_until(l, tp_end);
-            OUT(std::cout << "receiver::receive() wait time of " << seconds_timeout << " up" << std::endl);
-            break;
+            ready.push_back(std::make_pair(std::move(pending_.front()), proton::message()));
+            transfers += take(e, ready.back().second);
+            pending_.pop_front();
+            --pending_count_;
         }
     }
     
-    if (!buffer_.empty())
+    if (!ready.empty())
     {
-        m = std::move(buffer_.front());
-        buffer_.pop();
-        // Add a lambda to the work queue to call receive_done().
-        // This will tell the handler to add more credit.
+        consumed(transfers);
+        for (auto& r : ready)
+            complete(r.first, r.second);
+    }
+}
+
+namespace
+{
+    // Moves rather than copies the message into the executor
+    struct completion
+    {
+        receiver::receive_handler handler;
+        proton::message m;
+        
+        void operator()() { handler(m); }
+    };
+}
+
+void receiver::complete(pending_receive& p, proton::message& m) {
+    if (p.exec)
+        p.exec(completion{ std::move(p.handler), std::move(m) });
+    else
+        p.handler(m);
+}
+
+// Take a message out of buffer_, parking until there is one or the timeout
+// expires. Returns false on timeout.
+bool receiver::wait_for_message(entry& e, unsigned int seconds_timeout) {
+    if (buffer_.try_pop(e))
+        return true;
+    
+    blocked_.add(1);
+    auto start = std::chrono::steady_clock::now();
+    bool popped = true;
+    if (0 == seconds_timeout)
+        buffer_.pop(e);
+    else
+        popped = buffer_.pop_for(e, std::chrono::seconds(seconds_timeout));
+    wait_.record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count()));
+    blocked_.add(-1);
+    
+    if (!popped)
+        LOG_DEBUG("receiver::receive() wait time of " << seconds_timeout << " up");
+    return popped;
+}
+
+// Move the message out of an entry taken from buffer_, recording how long it
+// took to get here if it was timed on arrival. A compressed body is inflated
+// here, by the receiving thread, up to inflate_limit(). With manual acks the message is acked now
+// unless its id is handed out. Returns the transfers this completes, for
+// consumed().
+size_t receiver::take(entry& e, proton::message& m, delivery_id* id) {
+    m = std::move(e.message);
+    try
+    {
+        decompress_body(m, inflate_limit());
+    }
+    catch (const std::exception& x)
+    {
+        LOG_ERROR("cannot decompress message, passing it on as it is: " << x.what());
+    }
+    if (id)
+        *id = e.id;
+    else
+        ack(e.id);
+    buffered_bytes_ -= e.bytes;
+    buffered_bytes_total_.add(-int64_t(e.bytes));
+    memory_budget::process().release(e.bytes);
+    if (e.arrived)
+    {
+        latency_stats& stats = latency_stats::instance();
+        const int64_t now = latency_stats::now();
+        stats.record(STAGE_BUFFER, e.arrived, now);
+        stats.record(STAGE_END_TO_END, latency_stats::stamp(m, latency_stats::ENQUEUED_AT), now);
+    }
+    return e.transfers;
+}
+
+// The messages of n transfers have been taken out of buffer_. Rather than one credit per
+// message ask the handler for more credit once the messages in flight, that
+// is granted but not yet consumed, drop below the low-water mark, and only if
+// a request is not already queued. The request is also made while overflow_
+// holds messages, to move them into the room just made in buffer_:
+// in_flight() counts transfers, so envelopes unpacked into overflow_ may
+// never take it below the mark, and no more messages would come to flush them.
+void receiver::consumed(size_t n) {
+    consumed_ += n;
+    consumed_total_.add(n);
+    buffered_total_.add(-int64_t(n));
+    if ((in_flight() < controller_.low_water() || overflowed_.load() > 0) && !credit_pending_.exchange(true))
+    {
+        // A message was buffered so work_queue_ has been set by the proton thread
+        posts_.add();
         work_queue_->add([=]() { this->receive_done(); });
-        message_received = true;
     }
+}
 
-    return message_received;
+// Credit granted but not yet consumed, messages sent beyond our credit can
+// briefly make consumed_ overtake granted_
+size_t receiver::in_flight() const {
+    size_t consumed = consumed_.load();
+    size_t granted = granted_.load();
+    return granted > consumed ? granted - consumed : 0;
+}
+
+size_t receiver::credit() const {
+    size_t received = received_.load();
+    size_t granted = granted_.load();
+    return granted > received ? granted - received : 0;
 }
 
 void receiver::close() {
@@ -90,23 +341,178 @@ void receiver::on_receiver_open(proton::receiver& r) {
     receiver_ = r;
     std::lock_guard<std::mutex> l(lock_);
     work_queue_ = &receiver_.work_queue();
-    receiver_.add_credit(MAX_BUFFER); // Buffer is empty, initial credit is the limit
+    grant_credit(affordable(controller_.window())); // Buffer is empty, initial credit is the window
 }
 
 void receiver::on_message(proton::delivery &d, proton::message &m) {
     // Proton automatically reduces credit by 1 before calling on_message
-    std::lock_guard<std::mutex> l(lock_);
-    buffer_.push(m);
-    can_receive_.notify_all();
+    ++received_;
+    received_total_.add();
+    buffered_total_.add(1);
+    const size_t bytes = message_size(m);
+    controller_.message_arrived(bytes, credit_controller::clock::now());
+    buffered_bytes_ += bytes;
+    buffered_bytes_total_.add(int64_t(bytes));
+    memory_budget::process().acquire(bytes);
+    update_reservation();   // One credit fewer is out
+    if (journal_)
+        journal_->append(m);
+    
+    entry e = { std::move(m), 0, bytes, 0, 1 };
+    if (acks_.manual)
+    {
+        e.id = ++next_id_;
+        unacked_[e.id] = unacked_delivery{ d, 1 };
+    }
+    latency_stats& stats = latency_stats::instance();
+    if (stats.enabled())
+    {
+        e.arrived = latency_stats::now();
+        stats.record(STAGE_TRANSIT, latency_stats::stamp(e.message, latency_stats::SENT_AT), e.arrived);
+    }
+    
+    flush_overflow();
+    if (message_batch::is_batch(e.message))
+        unbatch(e);
+    else
+        buffer(std::move(e));
+    complete_pending();
+}
+
+void receiver::buffer(entry&& e) {
+    if (!overflow_.empty() || !buffer_.push(std::move(e)))
+    {
+        overflow_.push(std::move(e));
+        ++overflowed_;
+    }
+}
+
+// Buffers each message in the envelope e as an entry of its own. They share
+// e's id and bytes, and only the last completes the transfer.
+void receiver::unbatch(entry& e) {
+    std::vector<proton::message> parts;
+    try
+    {
+        decompress_body(e.message, inflate_limit());
+        message_batch::unbatch(e.message, parts);
+    }
+    catch (const std::exception& x)
+    {
+        LOG_ERROR("cannot unpack message batch, passing it on as it is: " << x.what());
+        buffer(std::move(e));
+        return;
+    }
+    if (parts.empty())
+    {
+        // Nothing to hand out, the transfer is done with
+        proton::message empty;
+        consumed(take(e, empty));
+        return;
+    }
+    const size_t n = parts.size();
+    if (e.id)
+        unacked_[e.id].parts = n;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const bool last = i + 1 == n;
+        const size_t bytes = last ? e.bytes - (n - 1) * (e.bytes / n) : e.bytes / n;
+        buffer(entry{ std::move(parts[i]), e.arrived, bytes, e.id, last ? size_t(1) : 0 });
+    }
+}
+
+// Move messages that did not fit into buffer_ once there is space
+void receiver::flush_overflow() {
+    while (!overflow_.empty() && buffer_.push(std::move(overflow_.front())))
+    {
+        overflow_.pop();
+        --overflowed_;
+    }
 }
 
 // called via work_queue
 void receiver::receive_done() {
-    // Add 1 credit, a receiver has taken a message out of the buffer.
-    receiver_.add_credit(1);
+    // Clear the flag first so consumption from here on queues another request
+    credit_pending_ = false;
+    flush_overflow();
+    complete_pending();
+    controller_.sample_consumption(consumed_.load(), credit_controller::clock::now());
+    
+    // Top the window back up with a single flow, as far as the byte budgets
+    // allow. A window that has shrunk below what is in flight just lets the
+    // existing credit run down.
+    size_t window = controller_.window();
+    size_t n = in_flight();
+    if (n < window)
+    {
+        size_t grant = affordable(window - n);
+        if (grant > 0)
+            grant_credit(grant);
+    }
+}
+
+// called via work_queue, accept every ack waiting in ack_queue_
+void receiver::flush_acks() {
+    flush_posted_ = false;
+    delivery_id id = 0;
+    int64_t n = 0;
+    while (ack_queue_.try_pop(id))
+    {
+        accept(id);
+        ++n;
+    }
+    if (n > 0)
+        ack_flushes_.add();
+    
+    // Acks that came in while we flushed scheduled no timer of their own
+    if (acks_waiting_.fetch_sub(n) - n > 0)
+        work_queue_->schedule(proton::duration(acks_.interval.count()), [this]() { this->flush_acks(); });
+}
+
+void receiver::accept(delivery_id id) {
+    auto i = unacked_.find(id);
+    if (i != unacked_.end() && --i->second.parts == 0)
+    {
+        i->second.delivery.accept();
+        unacked_.erase(i);
+    }
+}
+
+void receiver::grant_credit(size_t n) {
+    controller_.credit_granted(n, size_t(receiver_.credit()), credit_controller::clock::now());
+    receiver_.add_credit(uint32_t(n));
+    granted_ += n;
+    flows_.add();
+    credit_total_.add(n);
+    update_reservation();
+}
+
+// How many of n credits fit in the byte budgets, taking messages still to
+// come to be of average size. At least one if nothing is held at all.
+size_t receiver::affordable(size_t n) const {
+    size_t avg = std::max<size_t>(1, controller_.average_size());
+    size_t held = buffered_bytes_.load() + reserved_;
+    size_t max_bytes = controller_.limits().max_bytes;
+    size_t room = max_bytes > held ? max_bytes - held : 0;
+    room = std::min(room, memory_budget::process().available());
+    size_t fits = room / avg;
+    if (fits == 0 && held == 0)
+        fits = 1;
+    return std::min(n, fits);
+}
+
+// Keep what this receiver has taken from the memory_budget for its
+// outstanding credit in line with the credit and the average message size
+void receiver::update_reservation() {
+    size_t want = credit() * std::max<size_t>(1, controller_.average_size());
+    memory_budget& budget = memory_budget::process();
+    if (want > reserved_)
+        budget.acquire(want - reserved_);
+    else
+        budget.release(reserved_ - want);
+    reserved_ = want;
 }
 
 void receiver::on_error(const proton::error_condition& e) {
-    OUT(std::cerr << "unexpected error: " << e << std::endl);
+    LOG_ERROR("unexpected error: " << e);
     exit(1);
 }
@@ -27,45 +27,223 @@
 #include <proton/message.hpp>
 #include <proton/delivery.hpp>
 
-#include <condition_variable>
+#include "credit_controller.hpp"
+#include "ring_buffer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
 #include <mutex>
 #include <string>
 #include <queue>
+#include <unordered_map>
+#include <vector>
 
 // Forward declaration(s)
 namespace proton
 {
     class work_queue;
 }
+class counter;
+class gauge;
+class histogram;
+class journal;
+
+
+// How a receiver acknowledges messages. By default proton accepts each one
+// as it arrives, before the application has seen it. With manual set nothing
+// is accepted until the application acks it, and acks are sent in batches.
+struct ack_policy
+{
+    bool manual;
+    size_t batch;                           // Send acks once this many are waiting
+    std::chrono::milliseconds interval;     // or this long after the first of them
 
+    ack_policy()
+    : manual(false), batch(64), interval(10)
+    {}
+    
+    static ack_policy explicit_acks(size_t batch = 64, std::chrono::milliseconds interval = std::chrono::milliseconds(10))
+    {
+        ack_policy p;
+        p.manual = true;
+        p.batch = batch;
+        p.interval = interval;
+        return p;
+    }
+};
 
 // A thread safe receiving connection that blocks receiving threads when there
 // are no messages available, and maintains a bounded buffer of incoming
 // messages by issuing AMQP credit only when there is space in the buffer.
+// Credit is replenished in bulk once the buffered messages plus the credit
+// still outstanding fall below a low-water mark. The size of that window is
+// adapted to the consume rate and round trip time by a credit_controller.
+//
+// Credit is also granted against a byte budget. A receiver buffers, or has
+// credit out for, no more than credit_limits::max_bytes, estimating the
+// messages yet to come at the average size so far, and all receivers
+// together stay under the memory_budget ceiling. A receiver holding nothing
+// may always take one message, so a message bigger than the budget still
+// gets through and the process ceiling is overshot by at most one message
+// per receiver.
+//
+// The buffer is a lock free ring filled by the proton thread, receiving
+// threads only take a lock to park when it is empty.
+//
+// With a manual ack_policy receive() hands out a delivery_id to ack(). acks
+// go onto a lock free ring and the proton thread accepts them in batches.
+// Calls that do not hand out an id ack as they return the message.
+//
+// The container may be run by several threads. Proton serialises every event
+// and work_queue item of a connection, and a receiver owns exactly one
+// connection, so "the proton thread" below is whichever thread is handling
+// that connection at the time and needs no lock.
+//
+// A message_batch envelope is unpacked as it arrives, and its messages are
+// returned one by one like any other. Credit and memory are accounted per
+// envelope. With manual acks every message of an envelope has the envelope's
+// id, and it is accepted once each of them has been acked.
+//
+// A body deflated by a sender's compression_policy is inflated as the message
+// is returned, an envelope as it is unpacked. A body that would inflate past
+// the memory_budget ceiling, or MAX_INFLATED_SIZE, is passed on compressed.
+//
+// Given a journal, the proton thread appends every message to it as it
+// arrives, before it is buffered.
+//
+// With latency_stats enabled the receiver notes when each message arrived and
+// records its transit, buffer and end to end times as it is returned.
 class receiver :
     private proton::messaging_handler
 {
-    static const size_t MAX_BUFFER = 100; // Max number of buffered messages
+public:
+    // Completion for async_receive(), called with the received message
+    typedef std::function<void(proton::message&)> receive_handler;
+    // Runs a completion, for example by handing it to a thread pool
+    typedef std::function<void(std::function<void()>)> executor;
+    // A received message to ack(), 0 for none
+    typedef uint64_t delivery_id;
+    
+private:
+    struct pending_receive
+    {
+        receive_handler handler;
+        executor exec;
+    };
+    
+    // A received message, and when it arrived if latency is being measured
+    struct entry
+    {
+        proton::message message;
+        int64_t arrived;
+        size_t bytes;
+        delivery_id id;
+        size_t transfers;                  // 1, or 0 for all but the last message of a batch
+    };
+    
+    // A delivery waiting for ack() of each of its messages
+    struct unacked_delivery
+    {
+        proton::delivery delivery;
+        size_t parts;
+    };
+    
+    // Used in proton threads only, accessors are thread safe
+    credit_controller controller_;
     
     // Used in proton threads only
     proton::receiver receiver_;
+    std::queue<entry> overflow_;           // Messages sent beyond our credit, waiting for space in buffer_
+    size_t reserved_;                      // Bytes taken from the memory_budget for credit outstanding
+    std::unordered_map<delivery_id, unacked_delivery> unacked_; // Manual acks only
+    delivery_id next_id_;
+    journal* const journal_;               // Optional, not owned
     
     // Used in proton and user threads, protected by lock_
     std::mutex lock_;
     proton::work_queue* work_queue_;
-    std::queue<proton::message> buffer_; // Messages not yet returned by receive()
-    std::condition_variable can_receive_; // Notify receivers of messages
+    std::deque<pending_receive> pending_; // async_receive() calls waiting for a message
+    std::atomic<size_t> pending_count_;   // pending_.size(), read without lock_
+    
+    // Used in proton and user threads, lock free
+    ring_buffer<entry> buffer_;          // Messages not yet returned by receive()
+    std::atomic<size_t> granted_;        // Total AMQP credit issued
+    std::atomic<size_t> received_;       // Total messages received from the link
+    std::atomic<size_t> consumed_;       // Total messages returned by receive()
+    std::atomic<bool> credit_pending_;   // A receive_done() work item is queued
+    std::atomic<size_t> overflowed_;     // overflow_.size(), read without lock_
+    std::atomic<size_t> buffered_bytes_; // message_size() of the messages in buffer_ and overflow_
+    
+    // Used in proton and user threads for manual acks, lock free
+    const ack_policy acks_;
+    ring_buffer<delivery_id> ack_queue_; // Acked, waiting to be accepted by the proton thread
+    std::atomic<int64_t> acks_waiting_;  // Pushed onto ack_queue_ and not yet flushed
+    std::atomic<bool> flush_posted_;     // A flush_acks() work item is queued for a full batch
+    
+    // Process wide "receiver." metrics, thread safe
+    counter& received_total_;            // Messages received from the link
+    counter& consumed_total_;            // Messages returned by receive()
+    counter& posts_;                     // Work items added to the work_queue
+    counter& flows_;                     // add_credit() calls
+    counter& credit_total_;              // Credit issued by add_credit()
+    gauge& buffered_total_;              // Messages buffered, overflow included, in every receiver
+    gauge& buffered_bytes_total_;        // and their size
+    gauge& blocked_;                     // Threads waiting for a message
+    histogram& wait_;                    // Nanoseconds threads waited for a message
+    counter& acks_total_;                // Messages accepted by ack()
+    counter& ack_flushes_;               // Batches of acks sent
     
 public:
     
-    // Connect to url
-    receiver(proton::container& cont, const std::string& url, const std::string& address);
+    // Connect to url, the buffer is allocated for limits.max_messages. j, if
+    // given, must outlive the receiver.
+    receiver(proton::container& cont, const std::string& url, const std::string& address,
+             const credit_limits& limits = credit_limits(), const ack_policy& acks = ack_policy(),
+             journal* j = 0);
+    ~receiver();
     
     // Thread safe receive
     bool receive(proton::message& m, unsigned int seconds_timeout = 0);
     
+    // Thread safe receive, id is for ack() with a manual ack_policy and 0
+    // otherwise
+    bool receive(proton::message& m, delivery_id& id, unsigned int seconds_timeout = 0);
+    
+    // Thread safe, appends up to max messages to out, blocking only until
+    // the first is available. Returns the number of messages received, 0 on
+    // timeout.
+    size_t receive_batch(std::vector<proton::message>& out, size_t max, unsigned int seconds_timeout = 0);
+    // and appends their ids to ids
+    size_t receive_batch(std::vector<proton::message>& out, std::vector<delivery_id>& ids, size_t max,
+                         unsigned int seconds_timeout = 0);
+    
+    // Thread safe and lock free, accept a message received with a manual
+    // ack_policy. Ignores id 0.
+    void ack(delivery_id id);
+    
+    // Thread safe, returns immediately. handler is passed the next message
+    // and is run by exec, or inline by whichever thread has the message if
+    // exec is empty. That is the proton thread when none was buffered, so
+    // handlers run inline must not block. Pending calls are completed in
+    // the order they were made, calls still pending at close() are never
+    // completed.
+    void async_receive(receive_handler handler, executor exec = executor());
+    
+    // Thread safe, as async_receive() with a future for the message
+    std::future<proton::message> async_receive();
+    
     void close();
     
+    // Thread safe, for watching flow control at work
+    size_t credit() const;                // AMQP credit outstanding on the link
+    size_t buffered() const { return buffer_.size(); }
+    size_t buffered_bytes() const { return buffered_bytes_.load(); }
+    const credit_controller& controller() const { return controller_; }
+    
 private:
     // ==== The following are called by proton threads only.
     // ---- messaging_handler interface overrides
@@ -73,8 +251,25 @@ private:
     void on_message(proton::delivery& d, proton::message& m) override;
     void on_error(const proton::error_condition& e) override;
     
+    bool wait_for_message(entry& e, unsigned int seconds_timeout);
+    size_t take(entry& e, proton::message& m, delivery_id* id = 0);
+    size_t take_batch(std::vector<proton::message>& out, std::vector<delivery_id>* ids, size_t max,
+                      unsigned int seconds_timeout);
+    void consumed(size_t n);
+    size_t in_flight() const;
+    void flush_overflow();
+    void buffer(entry&& e);
+    void unbatch(entry& e);
+    void complete_pending();
+    static void complete(pending_receive& p, proton::message& m);
+    void grant_credit(size_t n);
+    size_t affordable(size_t n) const;
+    void update_reservation();
+    
     // called via work_queue
     void receive_done();
+    void flush_acks();
+    void accept(delivery_id id);
 };
 
 #endif /* receiver_hpp */
@@ -0,0 +1,144 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Contention benchmark for the receiver buffer. One producer thread, standing
+// in for the proton thread, feeds 1, 4 and 16 consumer threads through
+//  - ring_buffer, as used by receiver
+//  - a mutex guarded std::queue with a condition variable, as receiver used
+//    before
+// Both are bounded to the same capacity. No broker is needed.
+
+#include "ring_buffer.hpp"
+
+#include <proton/message.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct item
+{
+    proton::message m;
+    bool last = false;
+};
+
+// The previous receiver buffer
+class locked_queue
+{
+    const size_t capacity_;
+    std::mutex lock_;
+    std::queue<item> queue_;
+    std::condition_variable can_receive_;
+    
+public:
+    explicit locked_queue(size_t capacity) : capacity_(capacity) {}
+    
+    bool try_push(item&& i)
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        if (queue_.size() >= capacity_)
+            return false;
+        queue_.push(std::move(i));
+        can_receive_.notify_all();
+        return true;
+    }
+    
+    void pop(item& i)
+    {
+        std::unique_lock<std::mutex> l(lock_);
+        while (queue_.empty()) can_receive_.wait(l);
+        i = std::move(queue_.front());
+        queue_.pop();
+    }
+};
+
+class ring_queue
+{
+    ring_buffer<item> ring_;
+    
+public:
+    explicit ring_queue(size_t capacity) : ring_(capacity) {}
+    
+    bool try_push(item&& i) { return ring_.push(std::move(i)); }
+    void pop(item& i) { ring_.pop(i); }
+};
+
+// Returns messages per second through queue q
+template <class Queue>
+double run(size_t capacity, int consumers, int n)
+{
+    Queue q(capacity);
+    std::vector<std::thread> threads;
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < consumers; ++c)
+    {
+        threads.push_back(std::thread([&q]() {
+            item i;
+            do q.pop(i); while (!i.last);
+        }));
+    }
+    
+    // A full buffer means no credit, the producer yields until there is space
+    for (int k = 0; k < n + consumers; ++k)
+    {
+        item i;
+        i.m.body(std::to_string(k));
+        i.last = k >= n;
+        while (!q.try_push(std::move(i))) std::this_thread::yield();
+    }
+    
+    for (auto& t : threads)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    return n / elapsed.count();
+}
+
+int main(int argc, const char **argv) {
+    if (argc > 3) {
+        std::cerr <<
+        "Usage: " << argv[0] << " [MESSAGE-COUNT] [CAPACITY]\n"
+        "MESSAGE-COUNT: messages per run, default 1000000\n"
+        "CAPACITY: buffer capacity, default 100 as in receiver\n";
+        return 1;
+    }
+    
+    const int message_count = argc > 1 ? atoi(argv[1]) : 1000000;
+    const size_t capacity = argc > 2 ? size_t(atoi(argv[2])) : 100;
+    
+    std::cout << "consumers  mutex+queue msgs/s  ring_buffer msgs/s  speedup\n";
+    for (int consumers : {1, 4, 16})
+    {
+        double locked = run<locked_queue>(capacity, consumers, message_count);
+        double ring = run<ring_queue>(capacity, consumers, message_count);
+        std::cout << consumers << "\t   " << int(locked) << "\t\t\t" << int(ring) << "\t\t" << ring / locked << "x" << std::endl;
+    }
+    
+    return 0;
+}
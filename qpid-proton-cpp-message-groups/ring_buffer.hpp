@@ -0,0 +1,220 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ring_buffer_hpp
+#define ring_buffer_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+
+// A fixed capacity, lock free ring of T allocated up front. Each slot carries
+// a sequence number so producers and consumers only contend on the head and
+// tail positions. Safe for any number of producers and consumers, the
+// receiver uses it with the proton thread as the single producer.
+//
+// try_push()/try_pop() never block. pop() and pop_for() only take a mutex to
+// park the calling thread when the ring is empty, and push() only takes it
+// when it knows a consumer is parked.
+template <class T>
+class ring_buffer
+{
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t mask_;
+    std::unique_ptr<cell[]> cells_;
+
+    // Padded onto separate cache lines, producers only touch head_ and
+    // consumers tail_. Padding rather than alignas keeps the ring usable in
+    // heap allocated objects before C++17.
+    char pad0_[64];
+    std::atomic<size_t> head_;             // Next position to push
+    char pad1_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;             // Next position to pop
+    char pad2_[64 - sizeof(std::atomic<size_t>)];
+
+    // Parking for consumers of an empty ring
+    std::atomic<int> waiters_;
+    std::mutex park_lock_;
+    std::condition_variable not_empty_;
+
+    static size_t round_up(size_t n)
+    {
+        size_t capacity = 2;
+        while (capacity < n) capacity <<= 1;
+        return capacity;
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    explicit ring_buffer(size_t capacity)
+    : mask_(round_up(capacity) - 1), cells_(new cell[mask_ + 1]), head_(0), tail_(0), waiters_(0)
+    {
+        for (size_t i = 0; i <= mask_; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ring_buffer(const ring_buffer&) = delete;
+    ring_buffer& operator=(const ring_buffer&) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Approximate when called concurrently with push or pop
+    size_t size() const
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // Returns false if the ring is full, v is left untouched
+    bool try_push(T&& v)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell& c = cells_[pos & mask_];
+            size_t seq = c.sequence.load(std::memory_order_acquire);
+            intptr_t dif = intptr_t(seq) - intptr_t(pos);
+            if (dif == 0)
+            {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    c.value = std::move(v);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // try_push() and wake a parked consumer if there is one
+    bool push(T&& v)
+    {
+        if (!try_push(std::move(v)))
+            return false;
+        // Pairs with the fence in park(), either the consumer sees the new
+        // value or we see the consumer waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> l(park_lock_);
+            not_empty_.notify_one();
+        }
+        return true;
+    }
+
+    // Returns false if the ring is empty
+    bool try_pop(T& v)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell& c = cells_[pos & mask_];
+            size_t seq = c.sequence.load(std::memory_order_acquire);
+            intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+            if (dif == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    v = std::move(c.value);
+                    c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Block until a value is available
+    void pop(T& v)
+    {
+        if (try_pop(v))
+            return;
+        park(v, [this](std::unique_lock<std::mutex>& l) { not_empty_.wait(l); return true; });
+    }
+
+    // Block until a value is available or the timeout expires
+    template <class Rep, class Period>
+    bool pop_for(T& v, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        if (try_pop(v))
+            return true;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return park(v, [this, deadline](std::unique_lock<std::mutex>& l) {
+            return not_empty_.wait_until(l, deadline) == std::cv_status::no_timeout;
+        });
+    }
+
+    // Wake every parked consumer, they will find the ring empty and park again
+    // unless their timeout has expired.
+    void notify_all()
+    {
+        std::lock_guard<std::mutex> l(park_lock_);
+        not_empty_.notify_all();
+    }
+
+private:
+    // wait returns false once the consumer should give up
+    template <class Wait>
+    bool park(T& v, Wait wait)
+    {
+        std::unique_lock<std::mutex> l(park_lock_);
+        waiters_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool popped = false;
+        while (!(popped = try_pop(v)))
+        {
+            if (!wait(l))
+            {
+                popped = try_pop(v);
+                break;
+            }
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return popped;
+    }
+};
+
+#endif /* ring_buffer_hpp */
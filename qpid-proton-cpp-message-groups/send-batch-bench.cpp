@@ -0,0 +1,113 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Compares sender::send() called once per message against
+// sender::send_batch() for the same number of messages. Each run uses its
+// own container and connection and is timed until the connection has been
+// closed, so every message has been written to the wire.
+
+#include "sender.hpp"
+
+#include <proton/container.hpp>
+#include <proton/message.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static std::vector<proton::message> make_messages(int n)
+{
+    std::vector<proton::message> messages;
+    messages.reserve(n);
+    for (int i = 0; i < n; ++i)
+        messages.push_back(proton::message(std::to_string(i)));
+    return messages;
+}
+
+// Run fn against a fresh sender, return messages per second
+static double timed_run(const std::string& url, const std::string& address, int n,
+                        const std::function<void(sender&, std::vector<proton::message>&)>& fn)
+{
+    std::vector<proton::message> messages = make_messages(n);
+    proton::container container;
+    auto container_thread = std::thread([&]() { container.run(); });
+    sender s(container, url, address);
+    
+    auto start = std::chrono::steady_clock::now();
+    fn(s, messages);
+    s.close();
+    container_thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    return n / elapsed.count();
+}
+
+int main(int argc, const char **argv) {
+    try {
+        if (argc < 3 || argc > 5) {
+            std::cerr <<
+            "Usage: " << argv[0] << " CONNECTION-URL AMQP-ADDRESS [MESSAGE-COUNT] [BATCH-SIZE]\n"
+            "CONNECTION-URL: connection address, e.g.'amqp://127.0.0.1'\n"
+            "AMQP-ADDRESS: AMQP node address, e.g. 'examples'\n"
+            "MESSAGE-COUNT: messages sent per run, default 100000\n"
+            "BATCH-SIZE: messages per send_batch() call, default 1000\n";
+            return 1;
+        }
+        
+        const std::string url = argv[1];
+        const std::string address = argv[2];
+        const int message_count = argc > 3 ? atoi(argv[3]) : 100000;
+        const int batch_size = argc > 4 ? std::max(1, atoi(argv[4])) : 1000;
+        
+        double per_message = timed_run(url, address, message_count,
+            [](sender& s, std::vector<proton::message>& messages) {
+                for (auto& m : messages)
+                    s.send(m);
+            });
+        
+        double batched = timed_run(url, address, message_count,
+            [batch_size](sender& s, std::vector<proton::message>& messages) {
+                auto it = messages.begin();
+                while (it != messages.end())
+                {
+                    auto end = it + std::min<std::ptrdiff_t>(batch_size, messages.end() - it);
+                    s.send_batch(std::vector<proton::message>(std::make_move_iterator(it), std::make_move_iterator(end)));
+                    it = end;
+                }
+            });
+        
+        std::cout << "send():       " << int(per_message) << " msgs/s\n";
+        std::cout << "send_batch(): " << int(batched) << " msgs/s (batch size " << batch_size << ")\n";
+        std::cout << "speedup:      " << batched / per_message << "x" << std::endl;
+        
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -18,45 +18,300 @@
  */
 
 #include "sender.hpp"
-#include "out_lock.hpp"
+#include "latency.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "spill_file.hpp"
 
 #include <proton/connection.hpp>
+#include <proton/delivery.h>
+#include <proton/link.h>
 #include <proton/connection_options.hpp>
 #include <proton/receiver_options.hpp>
+#include <proton/sender_options.hpp>
 #include <proton/work_queue.hpp>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <sstream>
 #include <thread>
 
 
-sender::sender(proton::container& cont, const std::string& url, const std::string& address)
-: work_queue_(0), queued_(0), credit_(0)
+sender::sender(proton::container& cont, const std::string& url, const std::string& address, proton::delivery_mode mode,
+               spill_file* spill, const compression_policy& compression)
+: encoded_tag_(0), presettled_(mode == proton::delivery_mode::AT_MOST_ONCE), spill_(spill), compression_(compression),
+  work_queue_(0), queued_(0),
+  credit_(0), drain_posted_(false),
+  sent_(metrics::instance().get_counter("sender.sent")),
+  posts_(metrics::instance().get_counter("sender.work_queue_posts")),
+  queued_total_(metrics::instance().get_gauge("sender.queued")),
+  blocked_(metrics::instance().get_gauge("sender.blocked")),
+  credit_wait_(metrics::instance().get_histogram("sender.credit_wait_ns")),
+  spilled_total_(metrics::instance().get_gauge("sender.spilled")),
+  spilled_bytes_total_(metrics::instance().get_gauge("sender.spilled_bytes"))
 {
-    cont.open_sender(url+"/"+address, proton::connection_options().handler(*this));
+    // proton::sender::send() settles every delivery itself on a link opened
+    // AT_MOST_ONCE
+    cont.open_sender(url+"/"+address, proton::sender_options().delivery_mode(mode),
+                     proton::connection_options().handler(*this));
 }
 
 // Thread safe
 void sender::send(const proton::message& m) {
+    if (compressible(m, compression_))
+    {
+        send(proton::message(m));
+        return;
+    }
+    if (spill(m))
+        return;
+    int64_t queued = 0;
+    const int64_t enqueued = take_credit(queued);
+    work_queue_->add([=]() { this->do_send(m, enqueued, queued); }); // work_queue_ is thread safe
+}
+
+// Thread safe. C++11 lambdas cannot capture by move and work items must be
+// copyable, so the message is moved into a shared_ptr which the work item
+// holds instead.
+void sender::send(proton::message&& m) {
+    compress_body(m, compression_);
+    if (spill(m))
+        return;
+    int64_t queued = 0;
+    const int64_t enqueued = take_credit(queued);
+    auto owned = std::make_shared<proton::message>(std::move(m));
+    work_queue_->add([=]() { this->do_send(*owned, enqueued, queued); }); // work_queue_ is thread safe
+}
+
+// Thread safe, the work item holds a handle rather than a copy
+void sender::send(const pooled_message& m) {
+    if (compressible(*m, compression_))
+    {
+        send(proton::message(*m));    // The pooled message stays as it is
+        return;
+    }
+    if (spill(*m))
+        return;
+    int64_t queued = 0;
+    const int64_t enqueued = take_credit(queued);
+    work_queue_->add([=]() {
+        const proton::message& shared = *m;   // Other handles may be reading it
+        this->do_send(shared, enqueued, queued);
+    }); // work_queue_ is thread safe
+}
+
+// Thread safe, the work item shares the encoded bytes
+void sender::send(const encoded_message& m) {
+    bool spilled = false;
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        spilled = spilling();
+    }
+    if (spilled)
+    {
+        spill(m.data(), m.size());
+        return;
+    }
+    int64_t queued = 0;
+    take_credit(queued);
+    work_queue_->add([=]() { this->do_send(m); }); // work_queue_ is thread safe
+}
+
+// Take the credit for one message, blocking until there is some. Returns
+// when send() was called and sets queued to when it got the credit if latency
+// is being measured, both are 0 otherwise.
+int64_t sender::take_credit(int64_t& queued) {
+    latency_stats& stats = latency_stats::instance();
+    const int64_t enqueued = stats.enabled() ? latency_stats::now() : 0;
     {
         std::unique_lock<std::mutex> l(lock_);
         // Don't queue up more messages than we have credit for
-        while (!work_queue_ || queued_ >= credit_) sender_ready_.wait(l);
+        wait_for_credit(l);
         ++queued_;
     }
-    work_queue_->add([=]() { this->do_send(m); }); // work_queue_ is thread safe
+    sent_.add();
+    queued_total_.add(1);
+    posts_.add();
+    queued = enqueued ? latency_stats::now() : 0;
+    stats.record(STAGE_CREDIT_WAIT, enqueued, queued);
+    return enqueued;
+}
+
+// Take the credit for one message if there is some, without waiting. Sets
+// queued as take_credit() does.
+bool sender::try_take_credit(int64_t& queued) {
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        if (!work_queue_ || queued_ >= credit_ || (spill_ && !spill_->empty())) return false;
+        ++queued_;
+    }
+    sent_.add();
+    queued_total_.add(1);
+    posts_.add();
+    queued = latency_stats::instance().enabled() ? latency_stats::now() : 0;
+    return true;
+}
+
+// Thread safe
+bool sender::try_send(const proton::message& m) {
+    int64_t queued = 0;
+    if (!try_take_credit(queued))
+        return false;
+    if (compressible(m, compression_))
+    {
+        auto owned = std::make_shared<proton::message>(m);    // The one copy, compressed in place
+        compress_body(*owned, compression_);
+        work_queue_->add([=]() { this->do_send(*owned, queued, queued); }); // work_queue_ is thread safe
+        return true;
+    }
+    work_queue_->add([=]() { this->do_send(m, queued, queued); }); // work_queue_ is thread safe
+    return true;
+}
+
+// Thread safe
+bool sender::try_send(proton::message&& m) {
+    int64_t queued = 0;
+    if (!try_take_credit(queued))
+        return false;   // m is left as it was
+    compress_body(m, compression_);
+    auto owned = std::make_shared<proton::message>(std::move(m));
+    work_queue_->add([=]() { this->do_send(*owned, queued, queued); }); // work_queue_ is thread safe
+    return true;
+}
+
+// Thread safe
+int sender::available() {
+    std::lock_guard<std::mutex> l(lock_);
+    return work_queue_ ? std::max(0, credit_ - queued_) : 0;
+}
+
+// Thread safe
+size_t sender::spilled() const {
+    return spill_ ? spill_->count() : 0;
+}
+
+// Thread safe
+size_t sender::spilled_bytes() const {
+    return spill_ ? spill_->bytes() : 0;
+}
+
+// Called with lock_ held. Once anything is spilled everything is, until the
+// spill file is empty, so nothing overtakes it.
+bool sender::spilling() const {
+    return spill_ && (!spill_->empty() || !work_queue_ || queued_ >= credit_);
+}
+
+// Spills m if send() would otherwise wait for credit. Returns false, having
+// done nothing, if there is credit or no spill file.
+bool sender::spill(const proton::message& m) {
+    if (!spill_)
+        return false;
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        if (!spilling())
+            return false;
+    }
+    // Encode outside the lock, into a buffer each thread keeps
+    static thread_local std::vector<char> bytes;
+    m.encode(bytes);
+    spill(bytes.data(), bytes.size());
+    return true;
+}
+
+// Appends to the spill file, blocking only while it is full, and has the
+// proton thread drain it if there is credit already
+void sender::spill(const char* data, size_t size) {
+    std::unique_lock<std::mutex> l(lock_);
+    if (!spill_->push(data, size))
+    {
+        blocked_.add(1);
+        auto start = std::chrono::steady_clock::now();
+        while (!spill_->push(data, size)) sender_ready_.wait(l);
+        credit_wait_.record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+        blocked_.add(-1);
+    }
+    sent_.add();
+    spilled_total_.add(1);
+    spilled_bytes_total_.add(int64_t(size));
+    if (work_queue_ && queued_ < credit_ && !drain_posted_)
+    {
+        drain_posted_ = true;
+        posts_.add();
+        work_queue_->add([=]() { this->drain_spill(); }); // work_queue_ is thread safe
+    }
 }
 
 void sender::send(std::queue<proton::message>& messages)
 {
+    std::vector<proton::message> batch;
+    batch.reserve(messages.size());
     while(!messages.empty())
     {
-        proton::message& m = messages.front();
-        send(m);
-        OUT(std::cout << std::this_thread::get_id() << " sent \"" << m.body() << '"' << " group_id " << m.group_id() << " group_sequence " << m.group_sequence() << std::endl);
+        batch.push_back(std::move(messages.front()));
         messages.pop();
     }
+    send_batch(std::move(batch));
+}
+
+// Thread safe
+void sender::send_batch(std::vector<proton::message>&& messages)
+{
+    std::vector<proton::message> pending(std::move(messages));
+    const size_t total = pending.size();
+    if (compression_.enabled)
+    {
+        for (auto& m : pending)
+            compress_body(m, compression_);
+    }
+    latency_stats& stats = latency_stats::instance();
+    const int64_t enqueued = stats.enabled() ? latency_stats::now() : 0;
+    size_t next = 0;
+    while (next < total)
+    {
+        size_t n = 0;
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            if (spilling())
+            {
+                // The rest goes after what is already spilled, unless the
+                // spill file drains meanwhile and credit is back
+                l.unlock();
+                while (next < total && spill(pending[next]))
+                    ++next;
+                continue;
+            }
+            // Reserve all of the credit that is available right now
+            wait_for_credit(l);
+            n = std::min(total - next, size_t(credit_ - queued_));
+            queued_ += int(n);
+        }
+        sent_.add(n);
+        queued_total_.add(int64_t(n));
+        posts_.add();
+        
+        // One work item per slice, the whole batch if credit allows
+        std::shared_ptr<std::vector<proton::message> > slice;
+        if (next == 0 && n == total)
+        {
+            slice = std::make_shared<std::vector<proton::message> >(std::move(pending));
+        }
+        else
+        {
+            slice = std::make_shared<std::vector<proton::message> >(
+                std::make_move_iterator(pending.begin() + next),
+                std::make_move_iterator(pending.begin() + next + n));
+        }
+        next += n;
+        const int64_t queued = enqueued ? latency_stats::now() : 0;
+        stats.record(STAGE_CREDIT_WAIT, enqueued, queued);
+        work_queue_->add([=]() { this->do_send(*slice, enqueued, queued); }); // work_queue_ is thread safe
+    }
 }
 
 // Thread safe
@@ -64,6 +319,19 @@ void sender::close() {
     work_queue()->add([=]() { sender_.connection().close(); });
 }
 
+// Wait, holding l on lock_, until there is credit not taken by queued messages
+void sender::wait_for_credit(std::unique_lock<std::mutex>& l) {
+    if (work_queue_ && queued_ < credit_)
+        return;
+    
+    blocked_.add(1);
+    auto start = std::chrono::steady_clock::now();
+    while (!work_queue_ || queued_ >= credit_) sender_ready_.wait(l);
+    credit_wait_.record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count()));
+    blocked_.add(-1);
+}
+
 proton::work_queue* sender::work_queue() {
     // Wait till work_queue_ and sender_ are initialized.
     std::unique_lock<std::mutex> l(lock_);
@@ -78,25 +346,146 @@ void sender::on_sender_open(proton::sender& s) {
     std::lock_guard<std::mutex> l(lock_);
     sender_ = s;
     work_queue_ = &s.work_queue();
+    sender_ready_.notify_all(); // Notify threads waiting in work_queue()
 }
 
 void sender::on_sendable(proton::sender& s) {
-    std::lock_guard<std::mutex> l(lock_);
-    credit_ = s.credit();
-    sender_ready_.notify_all(); // Notify senders we have credit
+    bool drain = false;
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        credit_ = s.credit();
+        sender_ready_.notify_all(); // Notify senders we have credit
+        drain = spill_ && queued_ == 0 && !spill_->empty();
+    }
+    if (drain)
+        drain_spill();
 }
 
 // work_queue work items is are automatically dequeued and called by proton
 // This function is called because it was queued by send()
-void sender::do_send(const proton::message& m) {
+void sender::do_send(const proton::message& m, int64_t enqueued, int64_t queued) {
+    if (enqueued)
+    {
+        // Only timed messages pay for a copy
+        proton::message stamped(m);
+        stamp(stamped, enqueued, queued);
+        sender_.send(stamped);
+    }
+    else
+    {
+        sender_.send(m);
+    }
+    sent(1);
+}
+
+// The work item owns m, so it is stamped in place
+void sender::do_send(proton::message& m, int64_t enqueued, int64_t queued) {
+    if (enqueued)
+        stamp(m, enqueued, queued);
     sender_.send(m);
+    sent(1);
+}
+
+namespace
+{
+    // proton::sender does not hand out its pn_link_t, but a class derived
+    // from it may name the protected accessor it inherits
+    struct link_access : proton::sender
+    {
+        static pn_link_t* link(const proton::sender& s)
+        {
+            return (s.*&link_access::pn_object)();
+        }
+    };
+}
+
+// Called because it was queued by send() with an encoded_message. Writes the
+// bytes as a delivery of their own, as proton::sender::send() would once it
+// had encoded a message.
+void sender::do_send(const encoded_message& m) {
+    write_encoded(m.data(), m.size());
+    sent(1);
+}
+
+// Proton thread, pn_link_send() copies the bytes
+void sender::write_encoded(const char* data, size_t size) {
+    pn_link_t* link = link_access::link(sender_);
+    // Tags are 9 bytes so they can never equal the 8 byte tags
+    // proton::sender::send() uses on the same link
+    char tag[9] = { 'e' };
+    std::memcpy(tag + 1, &encoded_tag_, sizeof(encoded_tag_));
+    ++encoded_tag_;
+    pn_delivery_t* d = pn_delivery(link, pn_dtag(tag, sizeof(tag)));
+    pn_link_send(link, data, size);
+    pn_link_advance(link);
+    if (presettled_)
+        pn_delivery_settle(d);
+}
+
+// Proton thread, n messages queued by send() have been written to the link
+void sender::sent(size_t n) {
+    queued_total_.add(-int64_t(n));
+    bool drain = false;
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        queued_ -= int(n);            // work items were consumed from the work_queue
+        credit_ = sender_.credit();   // update credit
+        sender_ready_.notify_all();   // Notify senders we have space on queue
+        drain = spill_ && queued_ == 0 && !spill_->empty();
+    }
+    if (drain)
+        drain_spill();
+}
+
+// Proton thread, writes spilled messages in order while there is credit.
+// Nothing queued before them may still be waiting on the work_queue.
+void sender::drain_spill() {
+    {
+        std::lock_guard<std::mutex> l(lock_);
+        drain_posted_ = false;
+        if (queued_ > 0)
+            return;     // sent() drains once they have gone
+    }
+    const char* data = 0;
+    size_t size = 0;
+    int64_t count = 0;
+    int64_t bytes = 0;
+    while (sender_.credit() > 0 && spill_->front(data, size))
+    {
+        write_encoded(data, size);
+        spill_->pop();
+        ++count;
+        bytes += int64_t(size);
+    }
+    spilled_total_.add(-count);
+    spilled_bytes_total_.add(-bytes);
+    // Not a queued work item, so queued_ is left as it is
     std::lock_guard<std::mutex> l(lock_);
-    --queued_;                    // work item was consumed from the work_queue
     credit_ = sender_.credit();   // update credit
-    sender_ready_.notify_all();       // Notify senders we have space on queue
+    sender_ready_.notify_all();   // Notify senders there is room in the spill file
+}
+
+// Called because it was queued by send_batch(), drains the slice in one go
+void sender::do_send(std::vector<proton::message>& batch, int64_t enqueued, int64_t queued) {
+    for (auto& m : batch)
+    {
+        if (enqueued)
+            stamp(m, enqueued, queued);
+        sender_.send(m);
+    }
+    sent(batch.size());   // the whole slice was consumed from the work_queue
+}
+
+// Record the time spent on the work queue and add the send times to m
+void sender::stamp(proton::message& m, int64_t enqueued, int64_t queued) {
+    const int64_t sent = latency_stats::now();
+    latency_stats::instance().record(STAGE_WORK_QUEUE, queued, sent);
+    proton::message::property_map& properties = m.properties();
+    properties.put(latency_stats::ENQUEUED_AT, enqueued);
+    properties.put(latency_stats::SENT_AT, sent);
 }
 
 void sender::on_error(const proton::error_condition& e) {
-    OUT(std::cerr << "unexpected error: " << e << std::endl);
+    LOG_ERROR("unexpected error: " << e);
     exit(1);
 }
\ No newline at end of file
@@ -28,26 +28,68 @@
 #include <proton/receiver_options.hpp>
 #include <proton/message.hpp>
 #include <proton/delivery.hpp>
+#include <proton/delivery_mode.hpp>
+
+#include "compression.hpp"
+#include "encoded_message.hpp"
+#include "message_pool.hpp"
 
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <string>
 #include <queue>
+#include <vector>
 
 // Forward declaration(s)
 namespace proton
 {
     class work_queue;
 }
+class counter;
+class gauge;
+class histogram;
+class spill_file;
 
 
 // A thread-safe sending connection that blocks sending threads when there
 // is no AMQP credit to send messages.
+//
+// The container may be run by several threads. Proton serialises every event
+// and work_queue item of a connection, and a sender owns exactly one
+// connection, so state used only in proton handler threads needs no lock.
+//
+// With latency_stats enabled every message is stamped with when it was given
+// to send() and when it was written to the link.
+//
+// Opened with delivery_mode AT_MOST_ONCE the link is pre-settled: every
+// delivery is settled as it is written, so the peer sends no disposition for
+// it and proton keeps no state for it afterwards. Messages lost in transit
+// are lost, which suits telemetry. menagerie-bench --presettled 1 compares
+// the two modes.
+//
+// Given a spill_file, send() does not block when there is no credit. The
+// message is encoded into the spill file and send() returns, and from then
+// on every message is spilled until the file is empty again so none
+// overtakes another. The proton thread drains the file in order as credit
+// comes back, once everything queued before it has been written. send()
+// only blocks while the spill file is full. Spilled messages are not
+// stamped with latency properties.
+//
+// With an enabled compression_policy, bodies of at least its threshold are
+// deflated by the sending thread before they are queued, and marked with
+// content_encoding so receiver inflates them again. A message given by const
+// reference is copied to be compressed. Encoded messages are sent as they
+// are.
 class sender :
     private proton::messaging_handler
 {
-    // Only used in proton handler thread
+    // Only used in proton handler threads, one at a time
     proton::sender sender_;
+    uint64_t encoded_tag_;             // Delivery tag of the next encoded_message
+    const bool presettled_;
+    spill_file* const spill_;          // Optional, not owned, thread safe
+    const compression_policy compression_;
     
     // Shared by proton and user threads, protected by lock_
     std::mutex lock_;
@@ -55,19 +97,67 @@ class sender :
     std::condition_variable sender_ready_;
     int queued_;                       // Queued messages waiting to be sent
     int credit_;                       // AMQP credit - number of messages we can send
+    bool drain_posted_;                // A drain_spill() work item is queued
+    
+    // Process wide "sender." metrics, thread safe
+    counter& sent_;                    // Messages accepted by send()
+    counter& posts_;                   // Work items added to the work_queue
+    gauge& queued_total_;              // Messages queued, in every sender
+    gauge& blocked_;                   // Threads waiting for credit
+    histogram& credit_wait_;           // Nanoseconds threads waited for credit
+    gauge& spilled_total_;             // Messages in spill files, in every sender
+    gauge& spilled_bytes_total_;       // and their size
     
 public:
-    sender(proton::container& cont, const std::string& url, const std::string& address);
+    // spill, if given, must outlive the sender and serve no other
+    sender(proton::container& cont, const std::string& url, const std::string& address,
+           proton::delivery_mode mode = proton::delivery_mode::AT_LEAST_ONCE, spill_file* spill = 0,
+           const compression_policy& compression = compression_policy());
     
     // Thread safe
     void send(const proton::message& m);
     void send(std::queue<proton::message>& messages);
     
+    // Thread safe, m is moved through to the link without being copied
+    void send(proton::message&& m);
+    
+    // Thread safe, as send() but without copying m. It goes back to its
+    // message_pool once it has been written to the link.
+    void send(const pooled_message& m);
+    
+    // Thread safe, writes the already encoded bytes to the link as they are.
+    // One encoded_message can go to any number of senders. Not stamped with
+    // latency properties, being immutable.
+    void send(const encoded_message& m);
+    
+    // Thread safe, never blocks. Returns false if there is no credit for m,
+    // or messages are waiting in the spill file, in which case an rvalue m
+    // is left as it was.
+    bool try_send(const proton::message& m);
+    bool try_send(proton::message&& m);
+    
+    // Thread safe, credit not yet taken by queued messages
+    int available();
+    
+    // Thread safe, messages waiting in the spill file and their size
+    size_t spilled() const;
+    size_t spilled_bytes() const;
+    
+    // Thread safe, hands messages to the proton thread in as few work items
+    // as credit allows. Blocks until every message has been queued.
+    void send_batch(std::vector<proton::message>&& messages);
+    
     // Thread safe
     void close();
     
 private:
     proton::work_queue* work_queue();
+    void wait_for_credit(std::unique_lock<std::mutex>& l);
+    int64_t take_credit(int64_t& queued);
+    bool try_take_credit(int64_t& queued);
+    bool spilling() const;
+    bool spill(const proton::message& m);
+    void spill(const char* data, size_t size);
     
     // == messaging_handler overrides, only called in proton handler thread
     void on_sender_open(proton::sender& s) override;
@@ -76,7 +166,15 @@ private:
     
     // work_queue work items is are automatically dequeued and called by proton
     // This function is called because it was queued by send()
-    void do_send(const proton::message& m);
+    // enqueued and queued are 0 unless latency_stats are enabled
+    void do_send(const proton::message& m, int64_t enqueued, int64_t queued);
+    void do_send(proton::message& m, int64_t enqueued, int64_t queued);
+    void do_send(std::vector<proton::message>& batch, int64_t enqueued, int64_t queued);
+    void do_send(const encoded_message& m);
+    void write_encoded(const char* data, size_t size);
+    void sent(size_t n);
+    void drain_spill();
+    static void stamp(proton::message& m, int64_t enqueued, int64_t queued);
 };
 
 #endif /* sender_hpp */
@@ -0,0 +1,199 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "sender_pool.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <utility>
+
+
+namespace
+{
+    // Messages of a batch bound for one connection, those before next are
+    // sent
+    struct slice
+    {
+        std::vector<proton::message> messages;
+        size_t next;
+
+        size_t left() const { return messages.size() - next; }
+    };
+
+    // Hands s up to n messages of sl, all of them if they are all left
+    void send_part(sender& s, slice& sl, size_t n)
+    {
+        if (sl.next == 0 && n == sl.messages.size())
+        {
+            s.send_batch(std::move(sl.messages));
+        }
+        else
+        {
+            std::vector<proton::message> part(std::make_move_iterator(sl.messages.begin() + sl.next),
+                                              std::make_move_iterator(sl.messages.begin() + sl.next + n));
+            s.send_batch(std::move(part));
+        }
+        sl.next += n;
+    }
+
+    // Hands s as much of sl as it has credit for right now. Returns how many
+    // messages that was.
+    size_t send_available(sender& s, slice& sl)
+    {
+        size_t n = std::min(sl.left(), size_t(std::max(0, s.available())));
+        if (n)
+            send_part(s, sl, n);
+        return n;
+    }
+}
+
+sender_pool::sender_pool(const std::string& url, const std::string& address, size_t connections,
+                         size_t containers, routing r, int io_threads, proton::delivery_mode mode)
+: routing_(r), next_(0)
+{
+    containers = std::max<size_t>(1, std::min(containers, connections));
+    for (size_t i = 0; i < containers; ++i)
+    {
+        containers_.push_back(std::unique_ptr<proton::container>(new proton::container()));
+        proton::container& c = *containers_.back();
+        threads_.push_back(std::thread([&c, io_threads]() { c.run(std::max(1, io_threads)); }));
+    }
+    for (size_t i = 0; i < std::max<size_t>(1, connections); ++i)
+        senders_.push_back(std::unique_ptr<sender>(new sender(*containers_[i % containers], url, address, mode)));
+}
+
+sender_pool::~sender_pool()
+{
+    close();
+}
+
+// Thread safe
+void sender_pool::send(const proton::message& m)
+{
+    std::string group_id = m.group_id();
+    if (routing_ == BY_GROUP && !group_id.empty())
+    {
+        route(group_id).send(m);
+        return;
+    }
+
+    // Take the first connection with credit, starting from the cursor, and
+    // only block on the cursor's connection if none has any.
+    size_t start = next_++;
+    for (size_t i = 0; i < senders_.size(); ++i)
+    {
+        if (senders_[(start + i) % senders_.size()]->try_send(m))
+            return;
+    }
+    senders_[start % senders_.size()]->send(m);
+}
+
+// Thread safe, try_send() only moves m if it takes it
+void sender_pool::send(proton::message&& m)
+{
+    std::string group_id = m.group_id();
+    if (routing_ == BY_GROUP && !group_id.empty())
+    {
+        route(group_id).send(std::move(m));
+        return;
+    }
+
+    size_t start = next_++;
+    for (size_t i = 0; i < senders_.size(); ++i)
+    {
+        if (senders_[(start + i) % senders_.size()]->try_send(std::move(m)))
+            return;
+    }
+    senders_[start % senders_.size()]->send(std::move(m));
+}
+
+// Thread safe
+void sender_pool::send_batch(std::vector<proton::message>&& messages)
+{
+    const size_t start = next_++;
+    if (routing_ == ROUND_ROBIN)
+    {
+        // Fill the credit of each connection in turn from the cursor, the
+        // whole batch on one connection if it has room, and only block on
+        // the cursor's connection for what none has room for.
+        slice all = { std::move(messages), 0 };
+        messages.clear();
+        for (size_t i = 0; i < senders_.size() && all.left(); ++i)
+            send_available(*senders_[(start + i) % senders_.size()], all);
+        if (all.left())
+            send_part(*senders_[start % senders_.size()], all, all.left());
+        return;
+    }
+
+    // Split by connection, keeping each group's messages in order. Ungrouped
+    // messages travel with the cursor's slice.
+    std::map<size_t, slice> slices;
+    for (auto& m : messages)
+    {
+        std::string group_id = m.group_id();
+        size_t i = (group_id.empty() ? start : std::hash<std::string>()(group_id)) % senders_.size();
+        slices[i].messages.push_back(std::move(m));
+    }
+    messages.clear();
+
+    // Give every connection what it has credit for. Only when none has any,
+    // wait for one message's worth on the first, then go round again, so a
+    // connection without credit does not hold up the others.
+    while (!slices.empty())
+    {
+        size_t sent = 0;
+        for (auto s = slices.begin(); s != slices.end(); )
+        {
+            sent += send_available(*senders_[s->first], s->second);
+            if (s->second.left())
+                ++s;
+            else
+                s = slices.erase(s);
+        }
+        if (!sent && !slices.empty())
+        {
+            auto s = slices.begin();
+            send_part(*senders_[s->first], s->second, 1);
+            if (!s->second.left())
+                slices.erase(s);
+        }
+    }
+}
+
+// Thread safe
+void sender_pool::close()
+{
+    std::lock_guard<std::mutex> l(close_lock_);
+    if (threads_.empty())
+        return;
+
+    for (auto& s : senders_)
+        s->close();
+    // Each container stops once all of its connections have closed
+    for (auto& t : threads_)
+        t.join();
+    threads_.clear();
+}
+
+sender& sender_pool::route(const std::string& group_id)
+{
+    return *senders_[std::hash<std::string>()(group_id) % senders_.size()];
+}
@@ -0,0 +1,82 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef sender_pool_hpp
+#define sender_pool_hpp
+
+#include "sender.hpp"
+
+#include <proton/container.hpp>
+#include <proton/message.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Stripes sends over several sender connections to the same address, spread
+// over one or more containers each run by its own threads, so publishing is
+// not limited to one socket and one proton I/O thread.
+//
+// With ROUND_ROBIN every message goes to the next connection that has credit,
+// so the pool can use the combined credit of all links. BY_GROUP does the
+// same for messages without a group_id, but always sends messages of one
+// group over the same connection so the group stays in order.
+class sender_pool
+{
+public:
+    enum routing { ROUND_ROBIN, BY_GROUP };
+
+    // connections are assigned to containers in turn, each container is run
+    // with io_threads threads. Every sender is opened with mode.
+    sender_pool(const std::string& url, const std::string& address, size_t connections,
+                size_t containers = 1, routing r = BY_GROUP, int io_threads = 1,
+                proton::delivery_mode mode = proton::delivery_mode::AT_LEAST_ONCE);
+    ~sender_pool();
+
+    // Thread safe, blocks only when the chosen connection has no credit
+    void send(const proton::message& m);
+    // Thread safe, m is moved through to the link without being copied
+    void send(proton::message&& m);
+
+    // Thread safe, each group's messages keep their order. The batch is spread
+    // over the credit of every connection it may use, and blocks only when
+    // none of them has any.
+    void send_batch(std::vector<proton::message>&& messages);
+
+    // Thread safe, close all connections and join the container threads
+    void close();
+
+    size_t size() const { return senders_.size(); }
+
+private:
+    sender& route(const std::string& group_id);
+
+    const routing routing_;
+    std::vector<std::unique_ptr<proton::container> > containers_;
+    std::vector<std::thread> threads_;
+    std::vector<std::unique_ptr<sender> > senders_;
+    std::atomic<size_t> next_;          // Round robin cursor
+    std::mutex close_lock_;
+};
+
+#endif /* sender_pool_hpp */
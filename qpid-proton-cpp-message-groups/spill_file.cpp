@@ -0,0 +1,117 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "spill_file.hpp"
+#include "mapped_file.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace
+{
+    const size_t HEADER_SIZE = 4;
+    const uint32_t WRAP = 0xffffffff;   // The rest of the file is unused
+
+    uint32_t read_size(const char* p)
+    {
+        uint32_t size;
+        std::memcpy(&size, p, sizeof(size));
+        return size;
+    }
+
+    void write_size(char* p, uint32_t size)
+    {
+        std::memcpy(p, &size, sizeof(size));
+    }
+}
+
+spill_file::spill_file(const std::string& path, size_t capacity)
+: capacity_(capacity), head_(0), tail_(0), count_(0), bytes_(0)
+{
+    // Nothing is kept from before
+    std::remove(path.c_str());
+    file_.reset(new mapped_file(path, true, capacity));
+}
+
+spill_file::~spill_file()
+{
+}
+
+bool spill_file::push(const char* data, size_t size)
+{
+    const size_t need = HEADER_SIZE + size;
+    if (need > capacity_ || size >= WRAP)
+        throw std::length_error("message of " + std::to_string(size) + " bytes is bigger than the spill file");
+
+    std::lock_guard<std::mutex> l(lock_);
+    const size_t offset = size_t(head_ % capacity_);
+    const size_t pad = capacity_ - offset < need ? capacity_ - offset : 0;
+    if (head_ - tail_ + pad + need > capacity_)
+        return false;
+
+    char* base = file_->data();
+    if (pad >= HEADER_SIZE)
+        write_size(base + offset, WRAP);
+    head_ += pad;
+    char* p = base + size_t(head_ % capacity_);
+    write_size(p, uint32_t(size));
+    std::memcpy(p + HEADER_SIZE, data, size);
+    head_ += need;
+    bytes_ += size;
+    ++count_;
+    return true;
+}
+
+bool spill_file::front(const char*& data, size_t& size)
+{
+    std::lock_guard<std::mutex> l(lock_);
+    if (head_ == tail_)
+        return false;
+
+    const size_t offset = skip_wrap();
+    size = read_size(file_->data() + offset);
+    data = file_->data() + offset + HEADER_SIZE;
+    return true;
+}
+
+void spill_file::pop()
+{
+    std::lock_guard<std::mutex> l(lock_);
+    if (head_ == tail_)
+        return;
+    const size_t size = read_size(file_->data() + skip_wrap());
+    tail_ += HEADER_SIZE + size;
+    bytes_ -= size;
+    --count_;
+}
+
+// Called with lock_ held and a record to read, moves tail_ past any unused
+// end of the file and returns the offset of the oldest record
+size_t spill_file::skip_wrap()
+{
+    size_t offset = size_t(tail_ % capacity_);
+    if (capacity_ - offset < HEADER_SIZE || read_size(file_->data() + offset) == WRAP)
+    {
+        tail_ += capacity_ - offset;
+        offset = 0;
+    }
+    return offset;
+}
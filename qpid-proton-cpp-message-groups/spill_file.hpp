@@ -0,0 +1,80 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef spill_file_hpp
+#define spill_file_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class mapped_file;
+
+
+// A bounded first in first out queue of encoded messages in a memory mapped
+// file, used as a ring. Each record is a 4 byte size followed by the bytes,
+// and never wraps: a record that does not fit before the end of the file
+// starts again at the beginning. The file is emptied when it is opened, the
+// queue only holds overflow for as long as the process runs.
+//
+// Any number of threads may push(), one thread at a time may front() and
+// pop(). The bytes front() returns stay valid until the pop() after it.
+class spill_file
+{
+public:
+    // Throws std::runtime_error if the file cannot be created or mapped
+    spill_file(const std::string& path, size_t capacity);
+    ~spill_file();
+
+    spill_file(const spill_file&) = delete;
+    spill_file& operator=(const spill_file&) = delete;
+
+    // Returns false if there is no room for size bytes right now. Throws
+    // std::length_error if size bytes would never fit.
+    bool push(const char* data, size_t size);
+
+    // The oldest record, false if there is none
+    bool front(const char*& data, size_t& size);
+    void pop();
+
+    // Thread safe
+    size_t count() const { return count_; }
+    size_t bytes() const { return bytes_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return count_ == 0; }
+
+private:
+    size_t skip_wrap();
+
+    std::unique_ptr<mapped_file> file_;
+    const size_t capacity_;
+
+    // Positions only ever grow, the offset in the file is position % capacity_
+    std::mutex lock_;
+    uint64_t head_;                     // Where the next record goes
+    uint64_t tail_;                     // The oldest record
+
+    std::atomic<size_t> count_;         // Records
+    std::atomic<size_t> bytes_;         // Their sizes, headers not included
+};
+
+#endif /* spill_file_hpp */
@@ -0,0 +1,288 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef send_handler_hpp
+#define send_handler_hpp
+
+#include "message_size.hpp"
+
+#include <proton/connection.hpp>
+#include <proton/connection_options.hpp>
+#include <proton/container.hpp>
+#include <proton/delivery_mode.hpp>
+#include <proton/message.hpp>
+#include <proton/messaging_handler.hpp>
+#include <proton/receiver.hpp>
+#include <proton/sender.hpp>
+#include <proton/sender_options.hpp>
+#include <proton/types.hpp>
+#include <proton/work_queue.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Lock output from threads to avoid scrambling. One lock for the whole
+// program however many files include this.
+inline std::mutex& out_lock() {
+  static std::mutex lock;
+  return lock;
+}
+#define OUT(x) do { std::lock_guard<std::mutex> l(out_lock()); x; } while (false)
+
+// Caps on the messages handed to send() but not yet given to the link. 0 is
+// no cap, both 0 (the default) is unbounded. Bytes are counted by
+// message_size().
+struct send_limits {
+  // What a bounded send_handler does when send() would go over its limits
+  enum overflow_policy {
+    BLOCK,          // Wait for room
+    FAIL,           // Return false at once
+    TIMEOUT         // Wait up to timeout, then return false
+  };
+
+  size_t max_messages;
+  size_t max_bytes;
+  overflow_policy policy;
+  std::chrono::milliseconds timeout;
+
+  send_limits() : max_messages(0), max_bytes(0), policy(BLOCK), timeout(0) {}
+  send_limits(size_t messages, size_t bytes, overflow_policy p = BLOCK,
+              std::chrono::milliseconds t = std::chrono::milliseconds(0))
+    : max_messages(messages), max_bytes(bytes), policy(p), timeout(t) {}
+};
+
+// Handler for a single thread-safe sending and receiving connection.
+//
+// Unbounded, every send() is handed straight to the proton thread, which
+// buffers whatever the peer has not given credit for. Bounded, the proton
+// thread holds messages until there is credit, and send() applies the
+// overflow_policy once the messages or bytes outstanding reach the limits.
+// Either way only make_work() is used, so this builds without lambdas.
+//
+// After close() send() returns false, including in threads already waiting
+// for room. Messages it accepted before are still sent, the connection
+// closes once the last of them has gone to the link.
+//
+// With delivery_mode AT_MOST_ONCE the sender link is pre-settled, so proton
+// settles each message as it is sent and tracks nothing further for it.
+class send_handler : public proton::messaging_handler {
+  // Invariant
+  const std::string url_;
+  const std::string address_;
+  const bool receive_;
+  const send_limits limits_;
+  const proton::delivery_mode mode_;
+
+  // Messages travel to the proton thread by shared_ptr, so neither an rvalue
+  // given to send() nor the work item copy them
+  typedef std::shared_ptr<proton::message> message_ptr;
+
+  // Only used in proton handler thread
+  proton::sender sender_;
+  std::queue<std::pair<message_ptr, size_t> > messages_; // Bounded only, waiting for credit
+  bool closing_;                            // close_fn() ran, close once nothing is outstanding
+
+  // Shared by proton and user threads, protected by lock_
+  std::mutex lock_;
+  proton::work_queue *work_queue_;
+  std::condition_variable sender_ready_;
+  std::condition_variable messages_ready_;  // Outstanding messages were sent
+  size_t outstanding_;                      // Messages in send() not yet sent
+  size_t outstanding_bytes_;                // and their size
+  bool closed_;                             // close() was called
+
+public:
+  // With receive false only a sender is opened, so messages are left for
+  // other consumers of address.
+  send_handler(const std::string& url, const std::string& address, bool receive = true,
+               const send_limits& limits = send_limits(),
+               proton::delivery_mode mode = proton::delivery_mode::AT_LEAST_ONCE)
+    : url_(url), address_(address), receive_(receive), limits_(limits), mode_(mode), closing_(false),
+      work_queue_(0), outstanding_(0), outstanding_bytes_(0), closed_(false) {}
+
+  bool bounded() const { return limits_.max_messages || limits_.max_bytes; }
+
+  // Thread safe. Returns false if a bounded send_handler had no room for
+  // msg, at once with FAIL or after the timeout with TIMEOUT, and once
+  // close() has been called. Otherwise unbounded or BLOCK returns true.
+  bool send(const proton::message& msg) {
+    return send(proton::message(msg));
+  }
+
+  // Thread safe, as send() but msg is moved through to the link without
+  // being copied
+  bool send(proton::message&& msg) {
+    if (!bounded()) {
+      if (closed()) return false;
+      work_queue()->add(make_work(&send_handler::send_fn, this, std::make_shared<proton::message>(std::move(msg))));
+      return true;
+    }
+    size_t bytes = limits_.max_bytes ? message_size(msg) : 0;
+    if (!reserve(bytes)) return false;
+    work_queue()->add(make_work(&send_handler::send_bounded_fn, this,
+                                std::make_shared<proton::message>(std::move(msg)), bytes));
+    return true;
+  }
+
+  // Thread safe
+  size_t outstanding() {
+    std::lock_guard<std::mutex> l(lock_);
+    return outstanding_;
+  }
+
+  // Thread safe
+  void close() {
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      closed_ = true;
+      messages_ready_.notify_all();   // Fail the sends waiting for room
+    }
+    work_queue()->add(make_work(&send_handler::close_fn, this));
+  }
+
+private:
+  proton::work_queue* work_queue() {
+    // Wait till work_queue_ and sender_ are initialized.
+    std::unique_lock<std::mutex> l(lock_);
+    while (!work_queue_) sender_ready_.wait(l);
+    return work_queue_;
+  }
+
+  bool closed() {
+    std::lock_guard<std::mutex> l(lock_);
+    return closed_;
+  }
+
+  bool has_room(size_t bytes) const {
+    // A message bigger than max_bytes still goes when nothing else is outstanding
+    return (!limits_.max_messages || outstanding_ < limits_.max_messages) &&
+      (!limits_.max_bytes || outstanding_bytes_ == 0 || outstanding_bytes_ + bytes <= limits_.max_bytes);
+  }
+
+  // Count a message of bytes as outstanding, if the policy finds room for it
+  // before close()
+  bool reserve(size_t bytes) {
+    std::unique_lock<std::mutex> l(lock_);
+    switch (limits_.policy) {
+    case send_limits::BLOCK:
+      while (!closed_ && !has_room(bytes)) messages_ready_.wait(l);
+      break;
+    case send_limits::FAIL:
+      break;
+    case send_limits::TIMEOUT: {
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + limits_.timeout;
+      while (!closed_ && !has_room(bytes)) {
+        if (messages_ready_.wait_until(l, deadline) == std::cv_status::timeout && !has_room(bytes))
+          return false;
+      }
+      break;
+    }
+    }
+    if (closed_ || !has_room(bytes)) return false;
+    ++outstanding_;
+    outstanding_bytes_ += bytes;
+    return true;
+  }
+
+  void send_fn(message_ptr msg) {
+    sender_.send(*msg);
+  }
+
+  // Hold msg until there is credit, keeping messages in order
+  void send_bounded_fn(message_ptr msg, size_t bytes) {
+    if (messages_.empty() && sender_.credit() > 0) {
+      transmit(*msg, bytes);
+      close_if_done();
+    } else {
+      messages_.push(std::make_pair(msg, bytes));
+    }
+  }
+
+  void transmit(const proton::message& msg, size_t bytes) {
+    sender_.send(msg);
+    std::lock_guard<std::mutex> l(lock_);
+    --outstanding_;
+    outstanding_bytes_ -= bytes;
+    messages_ready_.notify_all();
+  }
+
+  // Held messages, and reserved ones still on their way to the work queue,
+  // go to the link before the connection closes
+  void close_fn() {
+    closing_ = true;
+    close_if_done();
+  }
+
+  void close_if_done() {
+    if (!closing_) return;
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      if (outstanding_) return;
+    }
+    closing_ = false;
+    sender_.connection().close();
+  }
+
+  // == messaging_handler overrides, only called in proton hander thread
+
+  // Note: this example creates a connection when the container starts.
+  // To create connections after the container has started, use
+  // container::connect().
+  // See @ref multithreaded_client_flow_control.cpp for an example.
+  void on_container_start(proton::container& cont) override {
+    cont.connect(url_);
+  }
+
+  void on_connection_open(proton::connection& conn) {
+    conn.open_sender(address_, proton::sender_options().delivery_mode(mode_));
+    if (receive_) conn.open_receiver(address_);
+  }
+
+  void on_sender_open(proton::sender& s) {
+    // sender_ and work_queue_ must be set atomically
+    std::lock_guard<std::mutex> l(lock_);
+    sender_ = s;
+    work_queue_ = &s.work_queue();
+    sender_ready_.notify_all();
+  }
+
+  void on_sendable(proton::sender& s) override {
+    while (!messages_.empty() && s.credit() > 0) {
+      transmit(*messages_.front().first, messages_.front().second);
+      messages_.pop();
+    }
+    close_if_done();
+  }
+
+  void on_error(const proton::error_condition& e) {
+    OUT(std::cerr << "unexpected error: " << e << std::endl);
+    exit(1);
+  }
+};
+
+#endif /* send_handler_hpp */
@@ -0,0 +1,154 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Consumer throughput against the number of links to one shared
+// subscription. Each run subscribes with LINKS links, each on its own
+// connection and with its own worker, publishes MESSAGE-COUNT messages to
+// the topic and is timed until every message has been handled. WORK-US
+// stands in for the application's cost per message, the more there is the
+// more the run is bound by the workers rather than the broker.
+
+#include "subscriber.hpp"
+#include "sender.hpp"
+
+#include <proton/container.hpp>
+#include <proton/message.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Returns messages per second for one shared subscription with links links
+static double run(const std::string& url, const std::string& address, int links, int n, int work_us) {
+    subscription_options opts {};
+    opts.shared = true;
+    opts.name = "bench-" + std::to_string(links); // A fresh subscription per run
+    opts.container_id = "shared-subscribe-bench";
+    opts.desired = n;
+    opts.links = links;
+    opts.connections = links;
+    opts.quiet = true;
+
+    const std::chrono::microseconds work {work_us};
+
+    subscriber sub {url, address, opts, [work](proton::message&) {
+        auto until = std::chrono::steady_clock::now() + work;
+        while (std::chrono::steady_clock::now() < until) {}
+    }};
+
+    // An exception escaping the thread would terminate the process, so it is
+    // passed out and rethrown once the thread has been joined
+    std::exception_ptr error {};
+    std::thread sub_thread {[&sub, &error]() {
+        try {
+            sub.run();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }};
+
+    // Messages published before every link is attached would be lost
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+    while (sub.links_open() < links) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            sub.stop();
+            sub_thread.join();
+            if (error) std::rethrow_exception(error);
+            throw std::runtime_error("subscription links did not open");
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    proton::container container {};
+    std::thread container_thread {[&container]() { container.run(); }};
+    sender snd {container, url, address};
+
+    auto start = std::chrono::steady_clock::now();
+    const int batch = 1000;
+
+    for (int sent = 0; sent < n; sent += batch) {
+        std::vector<proton::message> messages {};
+
+        for (int k = sent; k < std::min(n, sent + batch); k++) {
+            messages.push_back(proton::message(std::to_string(k)));
+        }
+
+        snd.send_batch(std::move(messages));
+    }
+
+    sub_thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    snd.close();
+    container_thread.join();
+
+    if (error) std::rethrow_exception(error);
+
+    return n / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (argc < 3 || argc > 6) {
+            std::cerr <<
+                "Usage: " << argv[0] << " CONNECTION-URL ADDRESS [MESSAGE-COUNT] [MAX-LINKS] [WORK-US]\n"
+                "CONNECTION-URL: connection address, e.g.'amqp://127.0.0.1'\n"
+                "ADDRESS: topic address, e.g. 'examples'\n"
+                "MESSAGE-COUNT: messages per run, default 200000\n"
+                "MAX-LINKS: largest link count tried, default 8\n"
+                "WORK-US: microseconds of work per message, default 10\n";
+            return 1;
+        }
+
+        const std::string url = argv[1];
+        const std::string address = argv[2];
+        const int message_count = argc > 3 ? atoi(argv[3]) : 200000;
+        const int max_links = argc > 4 ? std::max(1, atoi(argv[4])) : 8;
+        const int work_us = argc > 5 ? std::max(0, atoi(argv[5])) : 10;
+
+        double base = 0;
+        std::cout << "links  msgs/s  scaling\n";
+
+        for (int links = 1; links <= max_links; links *= 2) {
+            double rate = run(url, address, links, message_count, work_us);
+
+            if (links == 1) {
+                base = rate;
+            }
+
+            std::cout << links << "\t" << int(rate) << "\t" << rate / base << "x" << std::endl;
+        }
+
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    return 1;
+}
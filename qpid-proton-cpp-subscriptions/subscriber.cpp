@@ -0,0 +1,416 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "subscriber.hpp"
+
+#include <proton/connection.hpp>
+#include <proton/container.hpp>
+#include <proton/delivery.hpp>
+#include <proton/receiver_options.hpp>
+#include <proton/source.hpp>
+#include <proton/source_options.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+namespace {
+    int link_count(const subscription_options& opts) {
+        return std::max(opts.links, 1);
+    }
+
+    int connection_count(const subscription_options& opts) {
+        return std::min(std::max(opts.connections, 1), link_count(opts));
+    }
+
+    void usage() {
+        std::cerr << "Usage: <prog> CONNECTION-URL ADDRESS [COUNT] [OPTIONS]\n"
+            "  --durable            keep the subscription after the link detaches\n"
+            "  --shared             let other links consume the same subscription\n"
+            "  --global             share the subscription across container IDs\n"
+            "  --name NAME          link name\n"
+            "  --container-id ID    container ID\n"
+            "  --prefetch N         messages each link takes ahead of its workers (default 100)\n"
+            "  --workers N          threads handling each link's messages (default 1)\n"
+            "  --links N            links to a shared subscription (default 1)\n"
+            "  --connections N      connections the links are spread over (default 1)\n"
+            "  --quiet              count messages instead of printing them\n"
+            "  --journal DIR        journal every message to DIR\n";
+    }
+}
+
+subscriber_link::subscriber_link(subscriber& parent, const std::string& name)
+    : parent_(parent), name_(name), refill_(std::max(parent.opts_.prefetch / 2, 1)),
+      queue_(size_t(std::max(parent.opts_.prefetch, 1))) {
+}
+
+void subscriber_link::start() {
+    for (int i = 0; i < std::max(parent_.opts_.workers, 1); i++) {
+        workers_.push_back(std::thread([this]() { work(); }));
+    }
+}
+
+void subscriber_link::on_receiver_open(proton::receiver& rcv) {
+    if (!parent_.opts_.quiet) {
+        std::cout << "SUBSCRIBE: Opened receiver for source address '" << parent_.address_ << "'\n";
+    }
+
+    receiver_ = rcv;
+    work_queue_ = &rcv.work_queue();
+    open_ = true;
+    rcv.add_credit(uint32_t(std::max(parent_.opts_.prefetch, 1)));
+
+    parent_.links_open_++;
+}
+
+void subscriber_link::on_message(proton::delivery& dlv, proton::message& msg) {
+    // Prefetched messages can still arrive after the desired count, before
+    // the links close. Releasing them, which also keeps proton from
+    // accepting them, has the broker deliver them again to someone else.
+    if (!parent_.received()) {
+        dlv.release();
+        return;
+    }
+
+    if (parent_.journal_) {
+        parent_.journal_->append(msg);
+    }
+
+    item i {};
+    std::swap(i.message, msg);
+
+    if (!backlog_.empty() || !queue_.try_push(std::move(i))) {
+        backlog_.push(std::move(i));
+    }
+}
+
+void subscriber_link::close() {
+    if (!open_) {
+        return;
+    }
+
+    if (parent_.opts_.durable) {
+        receiver_.detach(); // Detaching leaves the subscription intact
+    } else {
+        receiver_.close();
+    }
+
+    open_ = false;
+}
+
+// Connection thread
+void subscriber_link::replenish() {
+    while (!backlog_.empty() && queue_.try_push(std::move(backlog_.front()))) {
+        backlog_.pop();
+    }
+
+    int desired = parent_.opts_.desired;
+
+    if (open_ && (desired == 0 || parent_.received_ < desired)) {
+        receiver_.add_credit(uint32_t(refill_));
+    }
+}
+
+// Worker threads
+void subscriber_link::work() {
+    item i {};
+
+    for (;;) {
+        queue_.pop(i);
+
+        if (i.stop) {
+            return;
+        }
+
+        parent_.handler_(i.message);
+
+        if (++handled_ % refill_ == 0) {
+            work_queue_->add([this]() { replenish(); });
+        }
+    }
+}
+
+// Anything still in the backlog and then a stop for each worker
+void subscriber_link::stop() {
+    std::queue<item> rest {};
+    std::swap(rest, backlog_);
+
+    for (size_t n = 0; n < workers_.size(); n++) {
+        item i {};
+        i.stop = true;
+        rest.push(std::move(i));
+    }
+
+    while (!rest.empty()) {
+        if (queue_.try_push(std::move(rest.front()))) {
+            rest.pop();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto& t : workers_) t.join();
+    workers_.clear();
+}
+
+subscriber::subscriber(const std::string& conn_url, const std::string& address,
+                       const subscription_options& opts, message_handler handler)
+    : conn_url_(conn_url), address_(address), opts_(opts), handler_(handler) {
+    if (!opts_.journal.empty()) {
+        journal_.reset(new journal(opts_.journal));
+    }
+
+    std::string name = opts_.name;
+
+    if (name.empty() && (opts_.durable || opts_.shared)) {
+        name = "sub-1"; // A stable link name
+    }
+
+    // A link is identified by container ID and link name, whatever connection
+    // it is on, so every link after the first needs a name of its own. Brokers
+    // take "NAME|N" to be one more link to the shared subscription NAME, as
+    // JMS clients use it.
+    for (int i = 0; i < link_count(opts_); i++) {
+        std::string link_name = name;
+
+        if (!name.empty() && i > 0) {
+            link_name += "|" + std::to_string(i + 1);
+        }
+
+        links_.push_back(std::unique_ptr<subscriber_link>(new subscriber_link(*this, link_name)));
+    }
+}
+
+void subscriber::run() {
+    std::string id = opts_.container_id;
+
+    if (id.empty() && (opts_.durable || opts_.shared)) {
+        id = "app-1"; // A stable container ID
+    }
+
+    std::unique_ptr<proton::container> cont {};
+
+    if (id.empty()) {
+        cont.reset(new proton::container(*this));
+    } else {
+        cont.reset(new proton::container(*this, id));
+    }
+
+    {
+        std::lock_guard<std::mutex> l(container_lock_);
+        if (stopped_) return;
+        container_ = cont.get();
+    }
+
+    for (auto& l : links_) l->start();
+
+    try {
+        cont->run(connection_count(opts_));
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> l(container_lock_);
+            container_ = nullptr;
+        }
+        for (auto& l : links_) l->stop();
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(container_lock_);
+        container_ = nullptr;
+    }
+    for (auto& l : links_) l->stop();
+}
+
+void subscriber::stop() {
+    std::lock_guard<std::mutex> l(container_lock_);
+    stopped_ = true;
+    if (container_) container_->stop();
+}
+
+// The connections and their work queues are taken before any of their
+// events can fire, so other threads may use the work queues from then on.
+// Other run() threads may already be in on_connection_open(), so the
+// vectors are filled under connections_lock_ and never reallocate.
+void subscriber::on_container_start(proton::container& cont) {
+    std::lock_guard<std::mutex> l(connections_lock_);
+    connections_.reserve(size_t(connection_count(opts_)));
+    connection_queues_.reserve(size_t(connection_count(opts_)));
+
+    for (int c = 0; c < connection_count(opts_); c++) {
+        connections_.push_back(cont.connect(conn_url_));
+        connection_queues_.push_back(&connections_.back().work_queue());
+    }
+}
+
+// Link i goes on connection i % connections
+void subscriber::on_connection_open(proton::connection& conn) {
+    size_t n, c;
+    {
+        std::lock_guard<std::mutex> l(connections_lock_);
+        n = size_t(connection_count(opts_));
+        c = size_t(std::find(connection_queues_.begin(), connection_queues_.end(), &conn.work_queue()) -
+                   connection_queues_.begin());
+    }
+
+    proton::source_options sopts {};
+    std::vector<proton::symbol> caps {"topic"};
+
+    if (opts_.shared) {
+        caps.push_back("shared");
+    }
+
+    if (opts_.global) {
+        caps.push_back("global"); // Global means shared across clients (distinct container IDs)
+    }
+
+    sopts.capabilities(caps);
+
+    if (opts_.durable) {
+        sopts.durability_mode(proton::source::UNSETTLED_STATE);
+        sopts.expiry_policy(proton::source::NEVER);
+    }
+
+    for (size_t i = c; i < links_.size(); i += n) {
+        proton::receiver_options opts {};
+
+        if (!links_[i]->name().empty()) {
+            opts.name(links_[i]->name());
+        }
+
+        // Credit is granted by hand as the link's workers catch up
+        opts.credit_window(0);
+        opts.source(sopts);
+        opts.handler(*links_[i]);
+
+        conn.open_receiver(address_, opts);
+    }
+}
+
+// Any link's connection thread, counts a message that has arrived. Returns
+// false if the desired messages have all arrived already, so this one is
+// not to be handled.
+bool subscriber::received() {
+    int n = ++received_;
+
+    if (opts_.desired == 0 || n < opts_.desired) {
+        return true;
+    }
+
+    if (n > opts_.desired) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> l(connections_lock_);
+
+    for (size_t c = 0; c < connection_queues_.size(); c++) {
+        connection_queues_[c]->add([this, c]() { close_connection(c); });
+    }
+
+    return true;
+}
+
+// Connection c's thread
+void subscriber::close_connection(size_t c) {
+    for (size_t i = c; i < links_.size(); i += size_t(connection_count(opts_))) {
+        links_[i]->close();
+    }
+
+    connections_[c].close();
+}
+
+int subscriber_main(int argc, char** argv, subscription_options opts) {
+    std::vector<std::string> args {};
+    for (int i = 1; i < argc; i++) {
+        std::string arg {argv[i]};
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--durable") {
+            opts.durable = true;
+        } else if (arg == "--shared") {
+            opts.shared = true;
+        } else if (arg == "--global") {
+            opts.global = true;
+        } else if (arg == "--quiet") {
+            opts.quiet = true;
+        } else if (arg == "--name" && has_value) {
+            opts.name = argv[++i];
+        } else if (arg == "--container-id" && has_value) {
+            opts.container_id = argv[++i];
+        } else if (arg == "--prefetch" && has_value) {
+            opts.prefetch = std::stoi(argv[++i]);
+        } else if (arg == "--workers" && has_value) {
+            opts.workers = std::stoi(argv[++i]);
+        } else if (arg == "--journal" && has_value) {
+            opts.journal = argv[++i];
+        } else if (arg == "--links" && has_value) {
+            opts.links = std::stoi(argv[++i]);
+        } else if (arg == "--connections" && has_value) {
+            opts.connections = std::stoi(argv[++i]);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            usage();
+            return 1;
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size() != 2 && args.size() != 3) {
+        usage();
+        return 1;
+    }
+
+    if (opts.links > 1 && !opts.shared) {
+        std::cerr << "SUBSCRIBE: --links needs a shared subscription\n";
+        return 1;
+    }
+
+    if (args.size() == 3) {
+        opts.desired = std::stoi(args[2]);
+    }
+
+    std::mutex output_lock {};
+    std::atomic<int> handled {0};
+
+    subscriber sub {args[0], args[1], opts, [&](proton::message& msg) {
+        if (opts.quiet) {
+            handled++;
+            return;
+        }
+
+        std::lock_guard<std::mutex> l(output_lock);
+        std::cout << "SUBSCRIBE: Received message '" << msg.body() << "'\n";
+    }};
+
+    try {
+        sub.run();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    if (opts.quiet) {
+        std::cout << "SUBSCRIBE: Received " << handled << " messages\n";
+    }
+
+    return 0;
+}
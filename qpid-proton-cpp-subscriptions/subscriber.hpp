@@ -0,0 +1,160 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#ifndef subscriber_hpp
+#define subscriber_hpp
+
+#include "journal.hpp"
+#include "ring_buffer.hpp"
+
+#include <proton/connection.hpp>
+#include <proton/message.hpp>
+#include <proton/messaging_handler.hpp>
+#include <proton/receiver.hpp>
+#include <proton/work_queue.hpp>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Which kind of subscription to make. The four subscribe programs are
+// presets of these.
+struct subscription_options {
+    bool durable {false};       // The subscription outlives the link
+    bool shared {false};        // Several links can consume one subscription
+    bool global {false};        // Shared across clients with distinct container IDs
+    std::string name {};        // Link name, "sub-1" when durable or shared
+    std::string container_id {}; // "app-1" when durable or shared
+    int desired {0};            // Stop after this many messages, 0 runs forever
+    int prefetch {100};         // Messages each link may take ahead of its workers
+    int workers {1};            // Per link, more than one delivers out of order
+    int links {1};              // Links to the subscription, more than one needs shared
+    int connections {1};        // Connections the links are spread over
+    bool quiet {false};         // Say nothing when links open
+    std::string journal {};     // Directory to journal every message to, if any
+};
+
+class subscriber;
+
+// One link to the subscription with its own bounded queue, worker threads
+// and credit. Its events all arrive on its connection's thread.
+class subscriber_link : public proton::messaging_handler {
+  public:
+    subscriber_link(subscriber& parent, const std::string& name);
+
+    void on_receiver_open(proton::receiver& rcv) override;
+    void on_message(proton::delivery& dlv, proton::message& msg) override;
+
+    const std::string& name() const { return name_; }
+
+    void start();
+    // Connection thread, detaching leaves a durable subscription intact
+    void close();
+    // Once the container has stopped, the workers finish what is queued
+    void stop();
+
+  private:
+    struct item {
+        proton::message message {};
+        bool stop {false};
+    };
+
+    void work();
+    void replenish();
+
+    subscriber& parent_;
+    const std::string name_;
+    const int refill_;
+
+    ring_buffer<item> queue_;
+    std::queue<item> backlog_ {};           // Connection thread only, when the broker oversends
+    std::vector<std::thread> workers_ {};
+    proton::receiver receiver_ {};
+    proton::work_queue* work_queue_ {nullptr};
+    std::atomic<int> handled_ {0};
+    bool open_ {false};
+};
+
+// Subscribes to a topic over opts.links links spread across opts.connections
+// connections, all on one container run with a thread per connection. Each
+// link's proton thread only takes messages off the link and pushes them onto
+// the link's queue for its workers. Credit is granted back as the workers
+// finish messages, so no more than prefetch messages per link are ever queued
+// or in flight. With a journal each message is appended to it on the proton
+// thread before it is queued. With a desired count exactly that many
+// messages are handled, any that arrive before the links close are released
+// back to the broker.
+class subscriber : public proton::messaging_handler {
+  public:
+    typedef std::function<void(proton::message&)> message_handler;
+
+    // handler is called on worker threads, concurrently when there is more
+    // than one worker in all
+    subscriber(const std::string& conn_url, const std::string& address,
+               const subscription_options& opts, message_handler handler);
+
+    // Runs the container and the workers until the desired number of
+    // messages has been handled or the connections close
+    void run();
+
+    // Thread safe, stops the container so run() returns, and keeps a run()
+    // not yet started from running at all
+    void stop();
+
+    // Thread safe, the links that have opened so far
+    int links_open() const { return links_open_; }
+
+    void on_container_start(proton::container& cont) override;
+    void on_connection_open(proton::connection& conn) override;
+
+  private:
+    friend class subscriber_link;
+
+    bool received();
+    void close_connection(size_t c);
+
+    const std::string conn_url_;
+    const std::string address_;
+    const subscription_options opts_;
+    const message_handler handler_;
+
+    std::unique_ptr<journal> journal_ {};
+    std::vector<std::unique_ptr<subscriber_link> > links_ {};
+    std::mutex connections_lock_ {};    // Guards filling the two vectors below
+    std::vector<proton::connection> connections_ {};
+    std::vector<proton::work_queue*> connection_queues_ {};
+    std::mutex container_lock_ {};      // Guards the two below
+    proton::container* container_ {nullptr};
+    bool stopped_ {false};
+    std::atomic<int> received_ {0};
+    std::atomic<int> links_open_ {0};
+};
+
+// Parses "CONNECTION-URL ADDRESS [COUNT] [OPTIONS]" on top of defaults and
+// runs a subscriber that prints each message. Returns the exit status.
+int subscriber_main(int argc, char** argv, subscription_options defaults);
+
+#endif /* subscriber_hpp */